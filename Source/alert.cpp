@@ -0,0 +1,289 @@
+#include <cstdio>        // remove
+#include <fstream>       // ifstream, ofstream
+#include "alert.h"
+using namespace std;
+
+const int TICK_SECONDS = 60;
+const int TOTAL_OVERSTAY = 2;
+const time_t OVERSTAY_LIMIT[TOTAL_OVERSTAY] = { 24 * 3600, 7 * 24 * 3600 };
+const string OVERSTAY_KIND[TOTAL_OVERSTAY] = { "OVERSTAY_24H", "OVERSTAY_7D" };
+const time_t RESERVATION_NOTICE = 15 * 60;   // Warn 15m before it ends
+const string RESERVATION_KIND = "RESERVATION_EXPIRING";
+
+
+//  Constructor: Initialize all data members
+//==============================================================
+TimerWheel::TimerWheel() {
+    this->current = 0;
+    this->total_alerts = 0;
+}
+
+
+// Set the current time, call once before scheduling anything
+//==============================================================
+void TimerWheel::start(time_t now) {
+    this->current = now / TICK_SECONDS;
+}
+
+
+void TimerWheel::schedule(const Alert &alert) {
+    ++this->total_alerts;
+    TimerWheel::place(alert);
+}
+
+
+// Put the alert in the lowest level whose range still covers it
+//==============================================================
+void TimerWheel::place(const Alert &alert) {
+    unsigned long long tick = alert.due / TICK_SECONDS;
+    if (alert.due < 0 || tick <= this->current) {
+        this->overdue.push_back(alert);
+        return;
+    }
+    for (int level = 0; level < TOTAL_LEVEL; ++level) {
+        int shift = SLOT_BITS * (level + 1);
+        // Same block of the level above? Then it belongs to this level
+        if ((tick >> shift) == (this->current >> shift)) {
+            int slot = (tick >> (SLOT_BITS * level)) & (TOTAL_SLOT - 1);
+            this->slots[level][slot].push_back(alert);
+            return;
+        }
+    }
+    this->overflow.push_back(alert);
+}
+
+
+// Move the alerts of the current slot of a level down the wheel
+//==============================================================
+void TimerWheel::cascade(int level) {
+    vector<Alert> moving;
+    if (level == TOTAL_LEVEL) {
+        moving.swap(this->overflow);
+    } else {
+        int slot = (this->current >> (SLOT_BITS * level)) & (TOTAL_SLOT - 1);
+        moving.swap(this->slots[level][slot]);
+    }
+    for (int i = 0; i < (int)moving.size(); ++i)
+        TimerWheel::place(moving[i]);
+}
+
+
+void TimerWheel::advance(time_t now, vector<Alert> &fired) {
+    unsigned long long target = now / TICK_SECONDS;
+    while (true) {
+        // Alerts that were already due when scheduled
+        if (!this->overdue.empty()) {
+            this->total_alerts -= this->overdue.size();
+            fired.insert(fired.end(), this->overdue.begin(),
+                         this->overdue.end());
+            this->overdue.clear();
+        }
+        if (this->current >= target) break;
+        // Nothing left to fire, jump straight to now
+        if (this->total_alerts == 0) {
+            this->current = target;
+            break;
+        }
+
+        ++this->current;
+        // Entering a new block of a level: refill the levels below it,
+        // from the top so alerts can drop through several levels
+        for (int level = TOTAL_LEVEL; level > 0; --level) {
+            unsigned long long mask = (1ULL << (SLOT_BITS * level)) - 1;
+            if ((this->current & mask) == 0)
+                TimerWheel::cascade(level);
+        }
+        vector<Alert> &slot = this->slots[0][this->current & (TOTAL_SLOT - 1)];
+        this->total_alerts -= slot.size();
+        fired.insert(fired.end(), slot.begin(), slot.end());
+        slot.clear();
+    }
+}
+
+
+u32 TimerWheel::getTotalAlerts() {
+    return this->total_alerts;
+}
+
+
+//==============================================================
+//     AlertMonitor: keeps the wheel in step with the garages   //
+//==============================================================
+
+
+static string alertKey(string site, string vehicleType, string plateNo) {
+    return site + '|' + vehicleType + '|' + plateNo;
+}
+
+
+//  Constructor: Initialize all data members
+//==============================================================
+AlertMonitor::AlertMonitor() {
+    this->last_checked = 0;
+    this->is_loaded = false;
+}
+
+
+// Alerts due after the last check are scheduled, the ones due by now
+// fire on the next advance(). The ones due before it were reported by
+// the run that checked them, all are if no run ever checked
+//==============================================================
+void AlertMonitor::loadSites(const vector<string> &sites, time_t now) {
+    const string types[2] = { "CAR", "MOTORCYCLE" };
+    lock_guard<mutex> guard(this->lock);
+    if (this->is_loaded) return;
+    ifstream checkRF(ALERT_CHECK_FILE.c_str());
+    long long lastChecked;
+    this->last_checked = checkRF >> lastChecked ? lastChecked : 0;
+    checkRF.close();
+    this->wheel.start(now);
+    for (int i = 0; i < (int)sites.size(); ++i) {
+        for (int j = 0; j < 2; ++j) {
+            vector<Stay> stays, bookings;
+            AutoParkingSystem siteVeh;
+            siteVeh.setSite(sites[i]);
+            siteVeh.setVehicleType(types[j]);
+            siteVeh.readFile();
+            siteVeh.getParkedStays(stays);
+            siteVeh.getAllBookings(bookings);
+            for (int k = 0; k < (int)stays.size(); ++k)
+                AlertMonitor::scheduleStay(stays[k], sites[i],
+                                           this->last_checked);
+            for (int k = 0; k < (int)bookings.size(); ++k)
+                AlertMonitor::scheduleBooking(bookings[k], sites[i],
+                                              this->last_checked);
+        }
+    }
+    this->is_loaded = true;
+}
+
+
+// Alerts of a stay or booking due after a given time
+//==============================================================
+void AlertMonitor::scheduleStay(const Stay &stay, string site, time_t after) {
+    string key = alertKey(site, stay.vehicle_type, stay.plate_no);
+    this->parked[key] = stay.date_time_in;
+    Alert alert;
+    alert.site = site;
+    alert.vehicle_type = stay.vehicle_type;
+    alert.plate_no = stay.plate_no;
+    alert.lot_no = stay.lot_no;
+    alert.since = stay.date_time_in;
+    for (int i = 0; i < TOTAL_OVERSTAY; ++i) {
+        alert.due = stay.date_time_in + OVERSTAY_LIMIT[i];
+        alert.kind = OVERSTAY_KIND[i];
+        if (alert.due > after) this->wheel.schedule(alert);
+    }
+}
+
+
+void AlertMonitor::scheduleBooking(const Stay &booking, string site,
+                                   time_t after) {
+    string key = alertKey(site, booking.vehicle_type, booking.plate_no);
+    this->booked[key].push_back(make_pair(booking.date_time_in,
+                                          booking.date_time_out));
+    Alert alert;
+    alert.site = site;
+    alert.vehicle_type = booking.vehicle_type;
+    alert.plate_no = booking.plate_no;
+    alert.lot_no = booking.lot_no;
+    alert.since = booking.date_time_in;
+    alert.due = booking.date_time_out - RESERVATION_NOTICE;
+    alert.kind = RESERVATION_KIND;
+    if (alert.due > after) this->wheel.schedule(alert);
+}
+
+
+void AlertMonitor::onPark(string site, string vehicleType, string plateNo,
+                          string lotNo, time_t dateTimeIn) {
+    lock_guard<mutex> guard(this->lock);
+    Stay stay;
+    stay.vehicle_type = vehicleType;
+    stay.plate_no = plateNo;
+    stay.lot_no = lotNo;
+    stay.date_time_in = dateTimeIn;
+    AlertMonitor::scheduleStay(stay, site, dateTimeIn);
+    // A booking this vehicle came for is used up
+    map<string, vector<pair<time_t, time_t> > >::iterator it =
+        this->booked.find(alertKey(site, vehicleType, plateNo));
+    if (it == this->booked.end()) return;
+    for (int i = 0; i < (int)it->second.size(); ++i) {
+        if (it->second[i].first - RESERVATION_EARLY <= dateTimeIn &&
+            dateTimeIn < it->second[i].second) {
+            it->second.erase(it->second.begin() + i);
+            break;
+        }
+    }
+}
+
+
+void AlertMonitor::onUnpark(string site, string vehicleType, string plateNo) {
+    lock_guard<mutex> guard(this->lock);
+    this->parked.erase(alertKey(site, vehicleType, plateNo));
+}
+
+
+void AlertMonitor::onReserve(string site, string vehicleType, string plateNo,
+                             string lotNo, time_t start, time_t end) {
+    lock_guard<mutex> guard(this->lock);
+    Stay booking;
+    booking.vehicle_type = vehicleType;
+    booking.plate_no = plateNo;
+    booking.lot_no = lotNo;
+    booking.date_time_in = start;
+    booking.date_time_out = end;
+    AlertMonitor::scheduleBooking(booking, site, 0);
+}
+
+
+// Alerts are dropped lazily if the vehicle left or the booking was used
+//==============================================================
+bool AlertMonitor::isStillDue(const Alert &alert) {
+    string key = alertKey(alert.site, alert.vehicle_type, alert.plate_no);
+    if (alert.kind.compare(RESERVATION_KIND) == 0) {
+        map<string, vector<pair<time_t, time_t> > >::iterator it =
+            this->booked.find(key);
+        if (it == this->booked.end()) return false;
+        for (int i = 0; i < (int)it->second.size(); ++i)
+            if (it->second[i].first == alert.since) return true;
+        return false;
+    }
+    map<string, time_t>::iterator it = this->parked.find(key);
+    return it != this->parked.end() && it->second == alert.since;
+}
+
+
+void AlertMonitor::advance(time_t now) {
+    lock_guard<mutex> guard(this->lock);
+    vector<Alert> fired;
+    this->wheel.advance(now, fired);
+    if (this->is_loaded && now > this->last_checked)
+        AlertMonitor::saveLastChecked(now);
+    if (fired.empty()) return;
+
+    ofstream alertWF(ALERT_FILE.c_str(), ios::app);
+    for (int i = 0; i < (int)fired.size(); ++i) {
+        if (!AlertMonitor::isStillDue(fired[i])) continue;
+        alertWF << fired[i].due << ' '
+                << fired[i].kind << ' '
+                << (fired[i].site.empty() ? "-" : fired[i].site) << ' '
+                << fired[i].vehicle_type << ' '
+                << fired[i].plate_no << ' '
+                << fired[i].lot_no << ' '
+                << fired[i].since << '\n';
+    }
+    alertWF.close();
+}
+
+
+// Replace the last checked time in one step, never going back
+//==============================================================
+void AlertMonitor::saveLastChecked(time_t now) {
+    this->last_checked = now;
+    string tempName = makeTempName(ALERT_CHECK_FILE);
+    ofstream checkWF(tempName.c_str());
+    checkWF << (long long)now << '\n';
+    checkWF.close();
+    if (!checkWF.good() || !replaceFile(tempName, ALERT_CHECK_FILE))
+        remove(tempName.c_str());
+}
@@ -0,0 +1,86 @@
+#ifndef ALERT_H
+#define ALERT_H
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "aps.h"
+
+const std::string ALERT_FILE = "alerts.log";
+// Time alerts were last checked up to, so a later run logs what came
+// due while nothing was checking (e.g. parked with --run)
+const std::string ALERT_CHECK_FILE = "alerts.chk";
+
+// Something to report once its due time has passed
+struct Alert {
+    time_t due;
+    std::string kind;
+    std::string site;
+    std::string vehicle_type;
+    std::string plate_no;
+    std::string lot_no;
+    time_t since;   // date_time_in or booking start it was made for
+};
+
+
+// Hierarchical timer wheel with one minute ticks. Scheduling is O(1)
+// and every alert is moved down at most TOTAL_LEVEL times before it
+// fires, so no scan over all parked vehicles is ever needed.
+class TimerWheel
+{
+    public:
+        TimerWheel();
+        void start(time_t);
+        void schedule(const Alert &);
+        // Move time to now & collect every alert that became due
+        void advance(time_t, std::vector<Alert> &);
+        u32 getTotalAlerts();
+    private:
+        static const int SLOT_BITS = 6;
+        static const int TOTAL_SLOT = 1 << SLOT_BITS;
+        static const int TOTAL_LEVEL = 4;   // 64^4 minutes, ~31 years
+        void place(const Alert &);
+        void cascade(int);
+        std::vector<Alert> slots[TOTAL_LEVEL][TOTAL_SLOT];
+        std::vector<Alert> overdue;
+        std::vector<Alert> overflow;
+        unsigned long long current;
+        u32 total_alerts;
+};
+
+
+// Watches parked vehicles & bookings of every site, writing overstay
+// and expiring booking alerts to ALERT_FILE. Safe to use from the
+// ingestion threads.
+class AlertMonitor
+{
+    public:
+        AlertMonitor();
+        // Schedule alerts for what is already parked & booked, the
+        // ones that came due since the last check are logged by the
+        // first advance()
+        void loadSites(const std::vector<std::string> &, time_t);
+        void onPark(std::string, std::string, std::string, std::string,
+                    time_t);
+        void onUnpark(std::string, std::string, std::string);
+        void onReserve(std::string, std::string, std::string, std::string,
+                       time_t, time_t);
+        void advance(time_t);
+    private:
+        void scheduleStay(const Stay &, std::string, time_t);
+        void scheduleBooking(const Stay &, std::string, time_t);
+        bool isStillDue(const Alert &);
+        void saveLastChecked(time_t);
+        TimerWheel wheel;
+        // What is parked & booked now, alerts for anything else are dropped
+        std::map<std::string, time_t> parked;
+        std::map<std::string,
+                 std::vector<std::pair<time_t, time_t> > > booked;
+        std::mutex lock;
+        time_t last_checked;
+        bool is_loaded;
+};
+
+#endif
@@ -1,18 +1,32 @@
-#include <algorithm>     // erase, remove
-#include <cctype>        // isdigit
+#include <algorithm>     // lower_bound, sort
+#include <cctype>        // isdigit, isalnum
 #include <ctime>         // time
+#include <dirent.h>      // opendir, readdir
 #include <fstream>       // fstream
-#include <iostream>      // cout
-#include <locale>        // toupper
-#include <stdlib.h>
+#include <mutex>         // mutex
+#include <sstream>       // istringstream
+#include <stdio.h>       // rename, remove
+#include <stdlib.h>      // mkdtemp, mkstemp, getenv
+#include <sys/stat.h>    // stat, fchmod
+#include <unistd.h>      // rmdir, close
 #include "aps.h"
+#include "audit.h"
+#include "bay.h"
+#include "clock.h"
+#include "plate.h"
+#include "pricing.h"
+#include "secret.h"
+#include "snapshot.h"
 using namespace std;
 
 const string CAR_FILENAME = "apscar.dat";
 const string MOTO_FILENAME = "apsmoto.dat";
-const int TOTAL_FLOOR = 10;
-const int TOTAL_LOT_PER_FLOOR = 10;
-const int TOTAL_ALL_LOT = TOTAL_FLOOR * TOTAL_LOT_PER_FLOOR;
+const string CAR_RESV_FILENAME = "apscarresv.dat";
+const string MOTO_RESV_FILENAME = "apsmotoresv.dat";
+const string CAR_HIST_FILENAME = "apscarhist.dat";
+const string MOTO_HIST_FILENAME = "apsmotohist.dat";
+
+map<string, AutoParkingSystem::CachedState> AutoParkingSystem::snapshot_cache;
 
 
 //  Constructor: Initialize all data members
@@ -22,13 +36,22 @@ AutoParkingSystem::AutoParkingSystem() {
     this->pin_no = "N/A";
     this->lot_no = "N/A";
     this->vehicle_type = "N/A";
-    this->date_time_in = time(NULL);
-    this->date_time_out = time(NULL);
-    this->duration = 0.0;
-    this->total_charges = 0.0;
+    this->site = "";
+    this->bay_type = "STANDARD";
+    this->input_error = "";
+    this->date_time_in = currentTime();
+    this->date_time_out = this->date_time_in;
+    this->duration = 0;
+    this->total_charges = 0;
     this->total_lines = 0;
     this->new_plate_no = true;
     this->correct_pin = true;
+    this->booking_moved = false;
+    this->booking_taken = false;
+    this->has_history = false;
+    this->store_failed = false;
+    this->is_plate_indexed = false;
+    this->store_stamp = this->booking_stamp = stampFile("");
 }
 
 
@@ -46,20 +69,42 @@ void AutoParkingSystem::setLotNo(string lotNo) {
 void AutoParkingSystem::setVehicleType(string vehicleType) {
     this->vehicle_type = this->formatString(vehicleType);
 }
+// Storage backend used by every instance (STORAGE_TEXT by default)
+string AutoParkingSystem::storage_type = STORAGE_TEXT;
+void AutoParkingSystem::setStorageType(string storageType) {
+    storage_type = storageType;
+}
+
+
+// Site (garage) this vehicle belongs to, empty for the main site
+void AutoParkingSystem::setSite(string site) {
+    this->site = site;
+}
+void AutoParkingSystem::setBayType(string bayType) {
+    this->bay_type = this->formatString(bayType);
+}
+// Use the event time (e.g. from a camera) instead of the current time
+void AutoParkingSystem::setDateTime(time_t dateTime) {
+    this->date_time_in = dateTime;
+    this->date_time_out = dateTime;
+}
 
 
 // Format string to uppercase with no space
 //==============================================================
 string AutoParkingSystem::formatString(string s) {
-    int i;
-    // Remove white spaces
-    s.erase(remove(s.begin(), s.end(), ' '), s.end());
-    // Convert to uppercase
-    locale loc;
-    for (i = 0; i < s.length(); ++i)
-        s[i] = toupper(s[i], loc);
+    // Remove white spaces & convert ASCII to uppercase in one pass
+    string::size_type i, len = 0;
+    char c;
+    for (i = 0; i < s.length(); ++i) {
+        c = s[i];
+        if (c == ' ') continue;
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        s[len++] = c;
+    }
+    s.resize(len);
     // Return formatted string s or N/A if s is empty string
-    if (i == 0)
+    if (len == 0)
         return "N/A";
     else
         return s;
@@ -69,16 +114,29 @@ string AutoParkingSystem::formatString(string s) {
 bool AutoParkingSystem::validateInput() {
     // Set flags
     bool isPnSet = true,
+         isValidPn = true,
          isPinSet = true,
          isValidPin1 = true,
          isValidPin2 = true,
          isVtSet = true,
-         isValidVT = true;
+         isValidVT = true,
+         isValidSite1 = true,
+         isValidBay = true;
 
     // Check if plate_no set or not
     if (this->plate_no.compare("N/A") == 0)
         isPnSet = false;
 
+    // Check plate_no is letters & digits only, it is written to files
+    // & receipts as it is
+    for (string::size_type i = 0; isPnSet && i < this->plate_no.length();
+         ++i) {
+        if (!isalnum((unsigned char)this->plate_no[i])) {
+            isValidPn = false;
+            break;
+        }
+    }
+
     // Check if pin_no set or not
     if (this->pin_no.compare("N/A") == 0)
         isPinSet = false;
@@ -104,85 +162,262 @@ bool AutoParkingSystem::validateInput() {
         this->vehicle_type.compare("MOTORCYCLE") != 0))
             isValidVT = false;
 
-    // Print out for invalid user input(s)
+    // Check site name, it becomes part of the file names
+    if (!isValidSite(this->site) && !isScratchSite(this->site))
+        isValidSite1 = false;
+
+    // Check the kind of bay the vehicle needs
+    if (bayTypeOf(this->bay_type) < 0)
+        isValidBay = false;
+
+    // Keep messages for invalid user input(s), one per line
+    this->input_error = "";
     if (!isPnSet)
-        cout << "Set plate number first." << endl;
+        this->input_error += "Set plate number first.\n";
+    if (!isValidPn)
+        this->input_error += "Invalid plate number. Must be letters & "
+                             "digits only.\n";
     if (!isPinSet)
-        cout << "Set PIN number first." << endl;
+        this->input_error += "Set PIN number first.\n";
     if (!isValidPin1)
-        cout << "Invalid PIN number. Must be 6 digits." << endl;
+        this->input_error += "Invalid PIN number. Must be 6 digits.\n";
     if (!isValidPin2)
-        cout << "Invalid PIN number. Must be digits only." << endl;
+        this->input_error += "Invalid PIN number. Must be digits only.\n";
     if (!isVtSet)
-        cout << "Set vehicle type first." << endl;
+        this->input_error += "Set vehicle type first.\n";
     if (!isValidVT)
-        cout << "Invalid vehicle type." << endl;
+        this->input_error += "Invalid vehicle type.\n";
+    if (!isValidSite1)
+        this->input_error += "Invalid site name.\n";
+    if (!isValidBay)
+        this->input_error += "Invalid bay type.\n";
 
     // Return true if all user inputs are valid
-    if (isPnSet && isPinSet && isValidPin1 &&
-        isValidPin2 && isVtSet && isValidVT)
+    if (isPnSet && isValidPn && isPinSet && isValidPin1 && isValidPin2 &&
+        isVtSet && isValidVT && isValidSite1 && isValidBay)
         return true;
     else
         return false;
 }
 
 
+// File that holds this site & vehicle type, empty if unknown type
+//==============================================================
+string AutoParkingSystem::getFileName() {
+    if (this->vehicle_type.compare("MOTORCYCLE") == 0)
+        return siteFileName(this->site, MOTO_FILENAME);
+    else if (this->vehicle_type.compare("CAR") == 0)
+        return siteFileName(this->site, CAR_FILENAME);
+    return "";
+}
+string AutoParkingSystem::getBookingFileName() {
+    if (this->vehicle_type.compare("MOTORCYCLE") == 0)
+        return siteFileName(this->site, MOTO_RESV_FILENAME);
+    else if (this->vehicle_type.compare("CAR") == 0)
+        return siteFileName(this->site, CAR_RESV_FILENAME);
+    return "";
+}
+
+
+string AutoParkingSystem::getHistoryFileName() {
+    if (this->vehicle_type.compare("MOTORCYCLE") == 0)
+        return siteFileName(this->site, MOTO_HIST_FILENAME);
+    else if (this->vehicle_type.compare("CAR") == 0)
+        return siteFileName(this->site, CAR_HIST_FILENAME);
+    return "";
+}
+
+
 // Read the file before doing anything to it
 //==============================================================
-void AutoParkingSystem::readFile() {
-    // Set flags
-    bool isMoto = false,
-         isCar = false;
-    if (this->vehicle_type.compare("MOTORCYCLE") == 0) isMoto = true;
-    else if (this->vehicle_type.compare("CAR") == 0) isCar = true;
-
-    // Read the file based on flags
-    ifstream apsRF;
-    if (isMoto) apsRF.open(MOTO_FILENAME.c_str());
-    else if (isCar) apsRF.open(CAR_FILENAME.c_str());
-    if (apsRF.good()) {
-        // Get the current total lines of the file
-        string tempLine;
+bool AutoParkingSystem::readFile() {
+    // Open the store of this site & vehicle type
+    this->storage = makeStorage(storage_type, this->getFileName());
+    // Reuse the record storage across calls, a garage never holds
+    // more than TOTAL_ALL_LOT vehicles so one reservation is enough
+    this->trans.clear();
+    this->trans.reserve(TOTAL_ALL_LOT);
+    this->store_failed = false;
+    this->is_plate_indexed = false;
+    if (!this->storage || this->getFileName().empty()) {
         this->total_lines = 0;
-        while (getline(apsRF, tempLine))
-            ++this->total_lines;
-            
-        // Clear error flags & set pos. to the beg. of the fstream
-        apsRF.clear();
-        apsRF.seekg(0, apsRF.beg);
-        
-        // Allocate memory & store all file data to it
-        this->trans = new Transport[this->total_lines];
-        for (int i = 0; i < this->total_lines; ++i) {
-            apsRF >> this->trans[i].lot_no
-                  >> this->trans[i].plate_no
-                  >> this->trans[i].date_time_in
-                  >> this->trans[i].pin_no;
+        AutoParkingSystem::readBookings();
+        return true;
+    }
+    // Stamped before reading, so a write made meanwhile leaves a stamp
+    // that does not match the next time
+    string storeName = this->storage->getFileName();
+    this->store_stamp = stampFile(storeName);
+    this->booking_stamp = stampFile(this->getBookingFileName());
+
+    // As the last snapshot found it? Then skip parsing the files
+    map<string, CachedState>::const_iterator cached =
+        snapshot_cache.find(storeName);
+    if (cached != snapshot_cache.end() && this->store_stamp.size >= 0 &&
+        isSameStamp(cached->second.store_stamp, this->store_stamp) &&
+        isSameStamp(cached->second.booking_stamp, this->booking_stamp)) {
+        this->trans = cached->second.trans;
+        this->storage->preload(this->trans);
+        this->total_lines = this->trans.size();
+        this->bookings = cached->second.bookings;
+        this->plate_bookings = cached->second.plate_bookings;
+        return true;
+    }
+    if (!this->storage->load(this->trans)) {
+        this->trans.clear();
+        this->store_failed = true;
+    }
+    this->total_lines = this->trans.size();
+    AutoParkingSystem::readBookings();
+    return !this->store_failed;
+}
+
+
+// Read the reservations, each lot keeps its bookings sorted by start
+//==============================================================
+void AutoParkingSystem::readBookings() {
+    this->bookings.clear();
+    this->plate_bookings.clear();
+    ifstream resvRF(this->getBookingFileName().c_str());
+    string lotNo;
+    Booking tempBooking;
+    PlateBooking tempPlate;
+    while (resvRF >> lotNo
+                  >> tempBooking.plate_no
+                  >> tempBooking.start
+                  >> tempBooking.end) {
+        this->bookings[lotNo].push_back(tempBooking);
+        tempPlate.lot_no = lotNo;
+        tempPlate.start = tempBooking.start;
+        tempPlate.end = tempBooking.end;
+        this->plate_bookings.insert(make_pair(tempBooking.plate_no,
+                                              tempPlate));
+    }
+    resvRF.close();
+    map<string, vector<Booking> >::iterator it;
+    for (it = this->bookings.begin(); it != this->bookings.end(); ++it)
+        sort(it->second.begin(), it->second.end(), isEarlierBooking);
+}
+
+
+// Rewrite the reservations, dropping the ones that already ended
+//==============================================================
+void AutoParkingSystem::writeBookings() {
+    string tempName = makeTempName(this->getBookingFileName());
+    ofstream resvWF(tempName.c_str());
+    if (resvWF.good()) {
+        map<string, vector<Booking> >::iterator it;
+        for (it = this->bookings.begin(); it != this->bookings.end(); ++it) {
+            for (int i = 0; i < (int)it->second.size(); ++i) {
+                if (it->second[i].end <= this->date_time_in) continue;
+                resvWF << it->first << ' '
+                       << it->second[i].plate_no << ' '
+                       << it->second[i].start << ' '
+                       << it->second[i].end << '\n';
+            }
         }
-    } else {
-        // Create the file if it does not exist
-        ofstream apsCF;
-        if (isMoto) apsCF.open(MOTO_FILENAME.c_str());
-        else if (isCar) apsCF.open(CAR_FILENAME.c_str());
-        apsCF.close();
-        // Allocate memory to prevent segementation fault
-        // when delete the unallocated memory
-        this->trans = new Transport[0];
-        // cout << "Failed to read the file\n";
-        // cout << "New file has been created.\n";
     }
-    apsRF.close();
+    resvWF.close();
+    if (!resvWF.good() || !replaceFile(tempName, this->getBookingFileName()))
+        remove(tempName.c_str());
 }
 
 
-// Write new plate_no or remove old plate_no from the file
+// Check whether lotNo has a booking overlapping [from, to)
+//==============================================================
+bool AutoParkingSystem::isBooked(string lotNo, time_t from, time_t to) {
+    map<string, vector<Booking> >::iterator it = this->bookings.find(lotNo);
+    if (it == this->bookings.end()) return false;
+    // Bookings of a lot never overlap, so sorted by start is also
+    // sorted by end: binary search the first one ending after from
+    Booking key;
+    key.end = from;
+    vector<Booking>::iterator found = upper_bound(it->second.begin(),
+        it->second.end(), key, isEarlierEnd);
+    return found != it->second.end() && found->start < to;
+}
+
+
+// Check whether a vehicle is parked in lotNo now
+//==============================================================
+bool AutoParkingSystem::isOccupied(string lotNo) {
+    for (int i = 0; i < this->total_lines; ++i)
+        if (this->trans[i].lot_no.compare(lotNo) == 0)
+            return true;
+    return false;
+}
+
+
+// Check whether plateNo has a booking overlapping [from, to)
+//==============================================================
+bool AutoParkingSystem::hasBooking(string plateNo, time_t from, time_t to) {
+    pair<multimap<string, PlateBooking>::iterator,
+         multimap<string, PlateBooking>::iterator> range =
+        this->plate_bookings.equal_range(plateNo);
+    for (; range.first != range.second; ++range.first)
+        if (range.first->second.start < to && from < range.first->second.end)
+            return true;
+    return false;
+}
+
+
+// Add a booking unless the lot or the plate is booked at that time,
+// the file is not written
+//==============================================================
+bool AutoParkingSystem::insertBooking(string lotNo, string plateNo,
+                                      time_t from, time_t to) {
+    if (to <= from || isBooked(lotNo, from, to) ||
+        hasBooking(plateNo, from, to))
+        return false;
+    Booking newBooking;
+    newBooking.plate_no = plateNo;
+    newBooking.start = from;
+    newBooking.end = to;
+    vector<Booking> &lotBookings = this->bookings[lotNo];
+    lotBookings.insert(upper_bound(lotBookings.begin(), lotBookings.end(),
+                       newBooking, isEarlierBooking), newBooking);
+    PlateBooking newPlate;
+    newPlate.lot_no = lotNo;
+    newPlate.start = from;
+    newPlate.end = to;
+    this->plate_bookings.insert(make_pair(plateNo, newPlate));
+    return true;
+}
+
+
+// Use up the booking of plate_no for date_time_in (from a little
+// before it starts), its lot goes in lotNo. False if it has none
 //==============================================================
-void AutoParkingSystem::writeFile() {
-    // Return if exceed max of total parking lot
-    if (this->total_lines == TOTAL_ALL_LOT) {
-        cout << "Sorry, no more parking lot. All full!" << endl;
-        return;
+bool AutoParkingSystem::takeBooking(string &lotNo) {
+    pair<multimap<string, PlateBooking>::iterator,
+         multimap<string, PlateBooking>::iterator> range =
+        this->plate_bookings.equal_range(this->plate_no);
+    for (; range.first != range.second; ++range.first) {
+        PlateBooking &booked = range.first->second;
+        if (booked.start - RESERVATION_EARLY > this->date_time_in ||
+            this->date_time_in >= booked.end)
+            continue;
+        // Bookings of a lot never share a start
+        vector<Booking> &lotBookings = this->bookings[booked.lot_no];
+        Booking key;
+        key.start = booked.start;
+        vector<Booking>::iterator found = lower_bound(lotBookings.begin(),
+            lotBookings.end(), key, isEarlierBooking);
+        if (found != lotBookings.end() && found->start == booked.start)
+            lotBookings.erase(found);
+        lotNo = booked.lot_no;
+        this->plate_bookings.erase(range.first);
+        return true;
     }
+    return false;
+}
+
+
+// Write new plate_no or remove old plate_no from the file
+//==============================================================
+ApsStatus AutoParkingSystem::writeFile() {
+    // What could not be read would be lost by writing over it
+    if (this->store_failed) return APS_STORAGE_ERROR;
     // Check whether plate_no already exist in file or not
     this->new_plate_no = true;
     int idxMatch = -1;
@@ -192,234 +427,562 @@ void AutoParkingSystem::writeFile() {
             this->new_plate_no = false;
             idxMatch = i;
             // Return if incorrect pin_no
-            if (this->trans[idxMatch].pin_no.compare(this->pin_no) != 0) {
-                cout << "Sorry, invalid pin no!" << endl;
+            if (!verifySecret(this->pin_no, this->trans[idxMatch].pin_no,
+                              PIN_HASH_ROUNDS)) {
+                audit.record(AUDIT_PIN_FAIL, this->date_time_out, this->site,
+                             this->plate_no, this->trans[idxMatch].lot_no);
                 this->correct_pin = false;
-                return;
+                return APS_INVALID_PIN;
             }
             // Else continue
             break;
         }
     }
-    // Set flags
-    bool isMoto = false,
-         isCar = false;
-    if (this->vehicle_type.compare("MOTORCYCLE") == 0) isMoto = true;
-    else if (this->vehicle_type.compare("CAR") == 0) isCar = true;
-    // Append plate_no if new_plate_no, else rewrite the whole file
-    ofstream apsWF;
-    if (isMoto) {
-        if (this->new_plate_no) apsWF.open(MOTO_FILENAME.c_str(), ios::app);
-        else apsWF.open(MOTO_FILENAME.c_str());
-    } else if (isCar) {
-        if (this->new_plate_no) apsWF.open(CAR_FILENAME.c_str(), ios::app);
-        else apsWF.open(CAR_FILENAME.c_str());
-    }
-    if (apsWF.good()) {
-        if (this->new_plate_no) {
-            AutoParkingSystem::genLotNo();
-            apsWF << this->lot_no << ' '
-                  << this->plate_no << ' ' 
-                  << this->date_time_in << ' '
-                  << this->pin_no << '\n';
+    if (!this->storage) return APS_INVALID_INPUT;
+    // Pick a lot for new plate_no & add it, return if no lot left for
+    // it. A booking it used stays on file until the vehicle is parked.
+    // Else remove old plate_no from the store
+    if (this->new_plate_no) {
+        AutoParkingSystem::genLotNo();
+        ApsStatus result = APS_OK;
+        if (this->lot_no.compare("N/A") == 0) {
+            result = APS_FULL;
         } else {
-            for (int i = 0; i < this->total_lines; ++i) {
-                if (i != idxMatch) {
-                    apsWF << this->trans[i].lot_no << ' '
-                          << this->trans[i].plate_no << ' '
-                          << this->trans[i].date_time_in << ' '
-                          << this->trans[i].pin_no << '\n';
-                }
-            }
+            Transport newTrans;
+            newTrans.lot_no = this->lot_no;
+            newTrans.plate_no = this->plate_no;
+            newTrans.date_time_in = this->date_time_in;
+            newTrans.pin_no = hashSecret(this->pin_no, PIN_HASH_ROUNDS);
+            // Nothing is audited, kept or billed for a change not stored
+            if (!this->storage->append(newTrans))
+                result = APS_STORAGE_ERROR;
         }
+        if (result != APS_OK) {
+            if (this->booking_taken) AutoParkingSystem::readBookings();
+            return result;
+        }
+        if (this->booking_taken) AutoParkingSystem::writeBookings();
+        audit.record(AUDIT_PARK, this->date_time_in, this->site,
+                     this->plate_no, this->lot_no);
     } else {
-        // cout << "Failed to write the file.\n";
+        if (!this->storage->remove(this->plate_no))
+            return APS_STORAGE_ERROR;
+        audit.record(AUDIT_UNPARK, this->date_time_out, this->site,
+                     this->plate_no, this->trans[idxMatch].lot_no);
     }
-    apsWF.close();
     // Calculate duration & total_charges for old plate_no only
     if (!this->new_plate_no) {
         this->date_time_in = this->trans[idxMatch].date_time_in;
         this->lot_no = this->trans[idxMatch].lot_no;
         AutoParkingSystem::calcDuration();
         AutoParkingSystem::calcCharges();
+        // Keep the finished stay for the reports
+        ofstream histWF(this->getHistoryFileName().c_str(), ios::app);
+        if (histWF.good())
+            histWF << this->lot_no << ' '
+                   << this->plate_no << ' '
+                   << this->date_time_in << ' '
+                   << this->date_time_out << ' '
+                   << formatMoney(this->total_charges) << '\n';
+        histWF.close();
     }
+    return APS_OK;
 }
 
 
-// Generate unique lot_no for new plate_no
+// Park or unpark only, validating & reading first
+//==============================================================
+ApsStatus AutoParkingSystem::park() {
+    // Nothing is opened for input that may name a bad site
+    if (!this->validateInput()) return APS_INVALID_INPUT;
+    this->lockFiles();
+    ApsStatus result = APS_STORAGE_ERROR;
+    if (this->readFile())
+        result = this->hasPlateNo() ? APS_ALREADY_PARKED : this->writeFile();
+    this->unlockFiles();
+    return result;
+}
+ApsStatus AutoParkingSystem::unpark() {
+    if (!this->validateInput()) return APS_INVALID_INPUT;
+    this->lockFiles();
+    ApsStatus result = APS_NOT_PARKED;
+    if (!this->readFile())
+        result = APS_STORAGE_ERROR;
+    else if (this->hasPlateNo() || this->resolvePlateNo())
+        result = this->writeFile();
+    this->unlockFiles();
+    return result;
+}
+
+
+void AutoParkingSystem::lockFiles() {
+    if (this->file_lock || this->getFileName().empty()) return;
+    this->file_lock.reset(new FileLock(this->getFileName()));
+}
+void AutoParkingSystem::unlockFiles() {
+    this->file_lock.reset();
+}
+
+
+// Take a plate_no that is not parked as the only similar parked plate
+// whose PIN matches, a camera may have misread it
+//==============================================================
+bool AutoParkingSystem::resolvePlateNo() {
+    vector<string> similar = this->findSimilarPlates(this->plate_no);
+    string match;
+    int totalMatch = 0;
+    for (int i = 0; i < (int)similar.size(); ++i) {
+        unordered_map<string, string>::iterator pin =
+            this->plate_pins.find(similar[i]);
+        if (pin != this->plate_pins.end() &&
+            verifySecret(this->pin_no, pin->second, PIN_HASH_ROUNDS)) {
+            match = similar[i];
+            ++totalMatch;
+        }
+    }
+    if (totalMatch != 1) return false;
+    this->plate_no = match;
+    return true;
+}
+
+
+// Generate unique lot_no for new plate_no. One vehicle under the lock
+// of the site's files, so the floors are not split across threads here
 //==============================================================
 void AutoParkingSystem::genLotNo() {
-    srand(time(NULL));
-    int randFloor, randLot;
-    string newLotNo;
-    bool isAvailable;
-    do {
-        // (randNo between max & min) + '0' + (diff between '0' & 'A')
-        randFloor = (rand() % TOTAL_FLOOR + 0) + 48 + 17;
-        randLot = rand() % TOTAL_LOT_PER_FLOOR + 1;
-        // Generate lot number for floor(alphabet) and lot(number)
-        newLotNo = "";
-        newLotNo += (char)randFloor;
-        if (randLot < 10) newLotNo += '0';    
-        newLotNo += to_string(randLot);
-        // If newLotNo already exist in the file, regenerate it
-        isAvailable = true;
-        for (int i = 0; i < this->total_lines; ++i) {
-            if (this->trans[i].lot_no.compare(newLotNo) == 0) {
-                isAvailable = false;
-                break;
-            }
+    this->lot_no = "N/A";
+    this->booking_moved = false;
+    this->booking_taken = false;
+    BayAllocator bays;
+    AutoParkingSystem::loadBays(bays);
+    int need = bayTypeOf(this->bay_type), floor, lot;
+
+    // A vehicle with a booking for now takes its booked lot, the
+    // booking is used up & the rest of it freed (in memory, writeFile()
+    // saves it once the vehicle is parked). A vehicle parked
+    // there before the lot was held may still be in it, or the bay
+    // may not suit the vehicle (e.g. a compact bay for an oversize
+    // one), then the booked vehicle gets a lot like any other
+    string bookedLot;
+    if (AutoParkingSystem::takeBooking(bookedLot)) {
+        this->booking_taken = true;
+        if (!AutoParkingSystem::isOccupied(bookedLot) &&
+            parseLotNo(bookedLot, floor, lot) &&
+            bays.canUse(need, floor, lot)) {
+            this->lot_no = bookedLot;
+            return;
+        }
+        this->booking_moved = true;
+    }
+
+    // Otherwise take the best fitting bay that is empty & not held
+    // for a booking
+    for (floor = 0; floor < TOTAL_FLOOR; ++floor)
+        for (lot = 1; lot <= TOTAL_LOT_PER_FLOOR; ++lot)
+            if (isBooked(makeLotNo(floor, lot), this->date_time_in,
+                         this->date_time_in + RESERVATION_HOLD))
+                bays.take(floor, lot);
+
+    // Floor & lot are picked randomly among the best fitting bays, the
+    // same vehicle at the same time always gets the same pick
+    Random rng = makeRandom(this->site + ' ' + this->vehicle_type + ' ' +
+                            this->plate_no + ' ' +
+                            to_string(this->date_time_in));
+    if (bays.allocate(need, floor, lot, rng))
+        this->lot_no = makeLotNo(floor, lot);
+}
+
+
+// Find an empty lot without bookings in [from, to), N/A if none
+//==============================================================
+// Lots taken now are skipped whatever the window: a vehicle parked
+// before a lot is held for a booking may stay into it
+//==============================================================
+string AutoParkingSystem::findFreeLot(time_t from, time_t to) {
+    uint16_t freeLots[TOTAL_FLOOR];
+    AutoParkingSystem::getFreeLots(freeLots);
+    string lotNo;
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor) {
+        for (int lot = 1; lot <= TOTAL_LOT_PER_FLOOR; ++lot) {
+            lotNo = makeLotNo(floor, lot);
+            if ((freeLots[floor] >> (lot - 1) & 1) &&
+                !isBooked(lotNo, from, to))
+                return lotNo;
         }
-        // If not, take the generated newLotNo
-        if (isAvailable) break;
-    } while (true);
-    // Pass here? we got one
-    this->lot_no = newLotNo;
+    }
+    return "N/A";
+}
+
+
+// Book a lot for plate_no in [from, to), call after readFile()
+//==============================================================
+bool AutoParkingSystem::reserveLot(time_t from, time_t to) {
+    // Lots of a store that could not be read only look free
+    if (this->store_failed || this->plate_no.compare("N/A") == 0 ||
+        to <= from || to <= this->date_time_in ||
+        AutoParkingSystem::hasBooking(this->plate_no, from, to))
+        return false;
+    this->lot_no = AutoParkingSystem::findFreeLot(from, to);
+    if (this->lot_no.compare("N/A") == 0 ||
+        !AutoParkingSystem::insertBooking(this->lot_no, this->plate_no,
+                                          from, to))
+        return false;
+    AutoParkingSystem::writeBookings();
+    return true;
+}
+
+
+int AutoParkingSystem::addBookings(const vector<Stay> &stays) {
+    int totalBooked = 0;
+    for (int i = 0; i < (int)stays.size(); ++i)
+        if (AutoParkingSystem::insertBooking(stays[i].lot_no,
+                                             stays[i].plate_no,
+                                             stays[i].date_time_in,
+                                             stays[i].date_time_out))
+            ++totalBooked;
+    if (totalBooked > 0) AutoParkingSystem::writeBookings();
+    return totalBooked;
 }
 
 
 // Calculate duration for old plate_no to calculate charges
 //==============================================================
 void AutoParkingSystem::calcDuration() {
-    // Get the duration in seconds as doubles
-    this->duration = difftime(this->date_time_out, this->date_time_in);
+    // Get the duration in whole seconds
+    this->duration = (int64_t)this->date_time_out - this->date_time_in;
 }
 
 
-// TODO: ADD WEEKEND & WEEKDAYS RATES\
-// Calculate charges for old plate_no based on duration
+// Calculate charges for old plate_no based on duration, with the
+// time of day/week & occupancy rules of the pricing table
 //==============================================================
 void AutoParkingSystem::calcCharges() {
-    this->total_charges = 0.0;
-    double seconds = this->duration;
-    double rates;
-    // Set flags
-    bool isMoto = false,
-         isCar = false;
-    if (this->vehicle_type.compare("MOTORCYCLE") == 0) isMoto = true;
-    else if (this->vehicle_type.compare("CAR") == 0) isCar = true;
-
-    if (isMoto) {
-        // Motorcycle RM2 per day
-        rates = 2.00;
-        while (seconds > 0.0) {
-            // Calculate/Increment/Add total_charges
-            this->total_charges += rates;
-            // Minus seconds by 1 day
-            seconds -= 3600 * 24;
+    // Occupancy at exit, counting the vehicle that is leaving
+    double occupancy = (double)this->trans.size() / TOTAL_ALL_LOT;
+    this->total_charges = getPricing()->calcCharges(this->vehicle_type,
+        this->date_time_in, this->duration, occupancy);
+}
+
+
+// Get every finished stay & every vehicle still parked (charges 0)
+//==============================================================
+void AutoParkingSystem::getAllStays(vector<Stay> &stays) {
+    Stay tempStay;
+    string charges;
+    tempStay.vehicle_type = this->vehicle_type;
+    ifstream histRF(this->getHistoryFileName().c_str());
+    while (histRF >> tempStay.lot_no
+                  >> tempStay.plate_no
+                  >> tempStay.date_time_in
+                  >> tempStay.date_time_out
+                  >> charges) {
+        // Older history has charges written as doubles
+        if (!parseMoney(charges, tempStay.charges)) continue;
+        tempStay.is_parked = false;
+        stays.push_back(tempStay);
+    }
+    histRF.close();
+    AutoParkingSystem::getParkedStays(stays);
+}
+void AutoParkingSystem::getParkedStays(vector<Stay> &stays) {
+    Stay tempStay;
+    tempStay.vehicle_type = this->vehicle_type;
+    for (int i = 0; i < this->total_lines; ++i) {
+        tempStay.lot_no = this->trans[i].lot_no;
+        tempStay.plate_no = this->trans[i].plate_no;
+        tempStay.date_time_in = this->trans[i].date_time_in;
+        tempStay.date_time_out = this->date_time_out;
+        tempStay.charges = 0;
+        tempStay.is_parked = true;
+        stays.push_back(tempStay);
+    }
+}
+
+
+// Free lots as one bitmap per floor, bit 0 is lot 01
+//==============================================================
+void AutoParkingSystem::getFreeLots(uint16_t *freeLots) {
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor)
+        freeLots[floor] = (1 << TOTAL_LOT_PER_FLOOR) - 1;
+    int floor, lot;
+    for (int i = 0; i < this->total_lines; ++i)
+        if (parseLotNo(this->trans[i].lot_no, floor, lot))
+            freeLots[floor] &= ~(1 << (lot - 1));
+}
+
+
+bool AutoParkingSystem::loadBays(BayAllocator &bays) {
+    ifstream baysRF(siteFileName(this->site, BAYS_FILE).c_str());
+    bool isLoaded = bays.loadLayout(baysRF, this->vehicle_type);
+    int floor, lot;
+    for (int i = 0; i < this->total_lines; ++i)
+        if (parseLotNo(this->trans[i].lot_no, floor, lot))
+            bays.take(floor, lot);
+    return isLoaded;
+}
+
+
+// Save the stamps of the files, records, bookings & free lots in
+// binary, call after readFile()
+//==============================================================
+static void writeStamp(ostream &out, const FileStamp &stamp) {
+    writeBin<int64_t>(out, stamp.size);
+    writeBin<int64_t>(out, stamp.mtime_ns);
+    writeBin<uint64_t>(out, stamp.inode);
+}
+static bool readStamp(istream &in, FileStamp &stamp) {
+    return readBin(in, stamp.size) && readBin(in, stamp.mtime_ns) &&
+           readBin(in, stamp.inode);
+}
+
+void AutoParkingSystem::writeSnapshot(ostream &out) {
+    writeStamp(out, this->store_stamp);
+    writeStamp(out, this->booking_stamp);
+    writeBin<uint32_t>(out, this->total_lines);
+    for (int i = 0; i < this->total_lines; ++i) {
+        writeBinStr(out, this->trans[i].lot_no);
+        writeBinStr(out, this->trans[i].plate_no);
+        writeBin<int64_t>(out, this->trans[i].date_time_in);
+        writeBinStr(out, this->trans[i].pin_no);
+    }
+    vector<Stay> bookingList;
+    AutoParkingSystem::getAllBookings(bookingList);
+    writeBin<uint32_t>(out, bookingList.size());
+    for (int i = 0; i < (int)bookingList.size(); ++i) {
+        writeBinStr(out, bookingList[i].lot_no);
+        writeBinStr(out, bookingList[i].plate_no);
+        writeBin<int64_t>(out, bookingList[i].date_time_in);
+        writeBin<int64_t>(out, bookingList[i].date_time_out);
+    }
+    uint16_t freeLots[TOTAL_FLOOR];
+    AutoParkingSystem::getFreeLots(freeLots);
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor)
+        writeBin<uint16_t>(out, freeLots[floor]);
+}
+
+
+// Load a snapshot written by writeSnapshot(), files are untouched
+// until writeAll() is called
+//==============================================================
+bool AutoParkingSystem::readSnapshot(istream &in, uint32_t version) {
+    uint32_t count;
+    int64_t dateTime;
+    Transport tempTrans;
+    vector<Transport> records;
+    FileStamp storeStamp = stampFile(""), bookingStamp = storeStamp;
+    // Older snapshots were not stamped, so they never match the files
+    if (version >= 3 &&
+        (!readStamp(in, storeStamp) || !readStamp(in, bookingStamp)))
+        return false;
+    if (!readBin(in, count) || count > TOTAL_ALL_LOT) return false;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!readBinStr(in, tempTrans.lot_no) ||
+            !readBinStr(in, tempTrans.plate_no) ||
+            !readBin(in, dateTime) ||
+            !readBinStr(in, tempTrans.pin_no))
+            return false;
+        tempTrans.date_time_in = dateTime;
+        records.push_back(tempTrans);
+    }
+
+    string lotNo;
+    int64_t start, end;
+    Booking tempBooking;
+    map<string, vector<Booking> > bookingMap;
+    if (!readBin(in, count)) return false;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!readBinStr(in, lotNo) ||
+            !readBinStr(in, tempBooking.plate_no) ||
+            !readBin(in, start) || !readBin(in, end))
+            return false;
+        tempBooking.start = start;
+        tempBooking.end = end;
+        bookingMap[lotNo].push_back(tempBooking);
+    }
+
+    // Free lots must agree with the records
+    this->is_plate_indexed = false;
+    this->trans.swap(records);
+    this->total_lines = this->trans.size();
+    uint16_t freeLots[TOTAL_FLOOR], savedLots;
+    AutoParkingSystem::getFreeLots(freeLots);
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor) {
+        if (!readBin(in, savedLots) || savedLots != freeLots[floor]) {
+            this->trans.swap(records);
+            this->total_lines = this->trans.size();
+            return false;
         }
-    } else if (isCar) {
-        // Loop 24 times for each day until no more seconds left
-        while (seconds > 0.0) {
-            for (int i = 0; i < 24 && seconds > 0.0; ++i) {
-                // (1st - 3rd)hr, rates is RM4.50/hr
-                if (i < 3) rates = 4.50;
-                // (4th & 5th)hr, rates is RM3.50/hr
-                else if (i < 5) rates = 3.50;
-                // (6th - 9th)hr, rates is RM3.00/hr
-                else if (i < 9) rates = 3.00;
-                // (10th - 18th)hr, rates is RM2.00/hr
-                else if (i < 18) rates = 2.00;
-                // (19th - 24th)hr, free
-                else rates = 0.00;
-                // Calculate/Increment/Add total_charges
-                this->total_charges += rates;
-                // Minus seconds by 1 hour
-                seconds -= 3600;
-            }
+    }
+    this->bookings.swap(bookingMap);
+    this->store_failed = false;
+    this->store_stamp = storeStamp;
+    this->booking_stamp = bookingStamp;
+    this->plate_bookings.clear();
+    PlateBooking tempPlate;
+    map<string, vector<Booking> >::iterator it;
+    for (it = this->bookings.begin(); it != this->bookings.end(); ++it) {
+        for (int i = 0; i < (int)it->second.size(); ++i) {
+            tempPlate.lot_no = it->first;
+            tempPlate.start = it->second[i].start;
+            tempPlate.end = it->second[i].end;
+            this->plate_bookings.insert(make_pair(it->second[i].plate_no,
+                                                  tempPlate));
         }
     }
+    return true;
 }
 
 
-// Swapping Algorithm
+// Finished stays as they are in the history file, the text is kept
+// as it is so the charges stay exactly as written
 //==============================================================
-void AutoParkingSystem::swapStr(string *s1, string *s2) {
-    string temp = *s1;
-    *s1 = *s2;
-    *s2 = temp;
+void AutoParkingSystem::writeHistory(ostream &out) {
+    vector<string> lines;
+    string line;
+    ifstream histRF(this->getHistoryFileName().c_str());
+    while (getline(histRF, line))
+        if (!line.empty()) lines.push_back(line);
+    histRF.close();
+    writeBin<uint32_t>(out, lines.size());
+    for (int i = 0; i < (int)lines.size(); ++i)
+        writeBinStr(out, lines[i]);
 }
-void AutoParkingSystem::swapTime(time_t *t1, time_t *t2) {
-    time_t temp = *t1;
-    *t1 = *t2;
-    *t2 = temp;
+
+
+// Read the stays written by writeHistory() for writeAll(), each must
+// parse. Grown as they are read, so a bad count can't ask for much
+//==============================================================
+bool AutoParkingSystem::readHistory(istream &in) {
+    uint32_t count;
+    string line, lotNo, plateNo, charges;
+    time_t dateTimeIn, dateTimeOut;
+    Money amount;
+    vector<string> lines;
+    if (!readBin(in, count)) return false;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!readBinStr(in, line)) return false;
+        istringstream ss(line);
+        if (!(ss >> lotNo >> plateNo >> dateTimeIn >> dateTimeOut
+                 >> charges) ||
+            !parseMoney(charges, amount))
+            return false;
+        lines.push_back(line);
+    }
+    this->history.swap(lines);
+    this->has_history = true;
+    return true;
 }
 
 
-// Sorting the file using Insertion Sort Algorithm
+// Replace the store & bookings with the ones held in memory, & the
+// history too if it was read from a snapshot
 //==============================================================
-void AutoParkingSystem::sortBy(string sortByWhat) {
-    if (this->total_lines == 0) {
-        cout << "No data in the file" <<endl;
-        return;
-    }
-    // Set flags for sorting
-    bool sortByPN = false,
-         sortByLN = false,
-         sortByDTI = false;
-    if (sortByWhat.compare("PLATE_NO") == 0) sortByPN = true;
-    else if (sortByWhat.compare("LOT_NO") == 0) sortByLN = true;
-    else if (sortByWhat.compare("DATE_TIME_IN") == 0) sortByDTI = true;
-
-    // Start sorting
-    int idxMin, cond;
-    for (int i = 0; i < this->total_lines - 1; ++i) {
-        idxMin = i;
-        for (int j = i + 1; j < this->total_lines; ++j) {
-            // Sort by what condition??
-            if (sortByPN)
-                cond = this->trans[j].plate_no.compare(this->trans[idxMin].plate_no);
-            else if (sortByLN)
-                cond = this->trans[j].lot_no.compare(this->trans[idxMin].lot_no);
-            else if (sortByDTI)
-                cond = this->trans[j].date_time_in - this->trans[idxMin].date_time_in;
-            // Whatever condition is, sort based on it
-            if (cond < 0) {
-                // Swap plate_no
-                AutoParkingSystem::swapStr(
-                    &this->trans[j].plate_no,
-                    &this->trans[idxMin].plate_no
-                );
-                // Swap lot_no
-                AutoParkingSystem::swapStr(
-                    &this->trans[j].lot_no,
-                    &this->trans[idxMin].lot_no
-                );
-                // Swap date_time_in
-                AutoParkingSystem::swapTime(
-                    &this->trans[j].date_time_in,
-                    &this->trans[idxMin].date_time_in
-                );
-                // Swap pin_no
-                AutoParkingSystem::swapStr(
-                    &this->trans[j].pin_no,
-                    &this->trans[idxMin].pin_no
-                );
-            }
-        }
+void AutoParkingSystem::writeAll() {
+    if (this->store_failed) return;
+    // Storage type may have changed since readFile(), e.g. migrating
+    this->storage = makeStorage(storage_type, this->getFileName());
+    if (this->storage)
+        this->storage->rewrite(this->trans);
+    if (this->has_history) {
+        string tempName = makeTempName(this->getHistoryFileName());
+        ofstream histWF(tempName.c_str());
+        for (int i = 0; i < (int)this->history.size(); ++i)
+            histWF << this->history[i] << '\n';
+        histWF.close();
+        if (!histWF.good() ||
+            !replaceFile(tempName, this->getHistoryFileName()))
+            remove(tempName.c_str());
     }
+    AutoParkingSystem::writeBookings();
+}
 
-    // Set flags for vehicle type
-    bool isMoto = false,
-         isCar = false;
-    if (this->vehicle_type.compare("MOTORCYCLE") == 0) isMoto = true;
-    else if (this->vehicle_type.compare("CAR") == 0) isCar = true;
-
-    // Replace the data in the file with the sorted data
-    ofstream sortFile;
-    if (isMoto) sortFile.open(MOTO_FILENAME.c_str());
-    else if (isCar) sortFile.open(CAR_FILENAME.c_str());
-    if (sortFile.good()) {
-        for (int i = 0; i < this->total_lines; ++i)
-            sortFile << this->trans[i].lot_no << ' '
-                     << this->trans[i].plate_no << ' '
-                     << this->trans[i].date_time_in << ' '
-                     << this->trans[i].pin_no << '\n';
-        // cout << "Data has been sorted by " << sortByWhat << endl;
-    } else {
-        // cout << "Data failed to be sorted by " << sortByWhat << endl;
+
+void AutoParkingSystem::cacheSnapshot(vector<AutoParkingSystem> &shards) {
+    for (int i = 0; i < (int)shards.size(); ++i) {
+        AutoParkingSystem &shard = shards[i];
+        unique_ptr<Storage> storage = makeStorage(storage_type,
+                                                  shard.getFileName());
+        if (!storage || shard.store_stamp.size < 0) continue;
+        CachedState &cached = snapshot_cache[storage->getFileName()];
+        cached.store_stamp = shard.store_stamp;
+        cached.booking_stamp = shard.booking_stamp;
+        cached.trans = shard.trans;
+        cached.bookings = shard.bookings;
+        cached.plate_bookings = shard.plate_bookings;
     }
-    sortFile.close();
+}
+
+
+// Empty the store & bookings, remove the history
+//==============================================================
+void AutoParkingSystem::clearAll() {
+    // Thrown away on purpose, even a store that could not be read
+    this->store_failed = false;
+    this->is_plate_indexed = false;
+    this->trans.clear();
+    this->total_lines = 0;
+    this->bookings.clear();
+    this->plate_bookings.clear();
+    AutoParkingSystem::writeAll();
+    remove(this->getHistoryFileName().c_str());
+}
+
+
+// Get every booking as a stay from its start to its end
+//==============================================================
+void AutoParkingSystem::getAllBookings(vector<Stay> &stays) {
+    Stay tempStay;
+    tempStay.vehicle_type = this->vehicle_type;
+    tempStay.charges = 0;
+    tempStay.is_parked = false;
+    map<string, vector<Booking> >::iterator it;
+    for (it = this->bookings.begin(); it != this->bookings.end(); ++it) {
+        for (int i = 0; i < (int)it->second.size(); ++i) {
+            tempStay.lot_no = it->first;
+            tempStay.plate_no = it->second[i].plate_no;
+            tempStay.date_time_in = it->second[i].start;
+            tempStay.date_time_out = it->second[i].end;
+            stays.push_back(tempStay);
+        }
+    }
+}
+
+
+// Ordering of bookings within a lot
+//==============================================================
+bool AutoParkingSystem::isEarlierBooking(const Booking &b1, const Booking &b2) {
+    return b1.start < b2.start;
+}
+bool AutoParkingSystem::isEarlierEnd(const Booking &b1, const Booking &b2) {
+    return b1.end < b2.end;
+}
+
+
+// Ordering of records for sortBy()
+//==============================================================
+bool AutoParkingSystem::isLessPlateNo(const Transport &t1, const Transport &t2) {
+    return t1.plate_no < t2.plate_no;
+}
+bool AutoParkingSystem::isLessLotNo(const Transport &t1, const Transport &t2) {
+    return t1.lot_no < t2.lot_no;
+}
+bool AutoParkingSystem::isEarlierIn(const Transport &t1, const Transport &t2) {
+    return t1.date_time_in < t2.date_time_in;
+}
+
+
+// Sort the records read by readFile(). Only this object's copy is
+// sorted, the file is left alone so admin listings & searches never
+// rewrite what the gates are using
+//==============================================================
+void AutoParkingSystem::sortBy(string sortByWhat) {
+    if (this->total_lines == 0) return;
+    if (sortByWhat.compare("PLATE_NO") == 0)
+        sort(this->trans.begin(), this->trans.end(), isLessPlateNo);
+    else if (sortByWhat.compare("LOT_NO") == 0)
+        sort(this->trans.begin(), this->trans.end(), isLessLotNo);
+    else if (sortByWhat.compare("DATE_TIME_IN") == 0)
+        stable_sort(this->trans.begin(), this->trans.end(), isEarlierIn);
 }
 
 
@@ -463,10 +1026,9 @@ string AutoParkingSystem::searchBy(string searchBy, string key) {
 }
 
 
-// Destructor: Free all allocated memories
+// Destructor: trans owns its records, nothing to free by hand
 //==============================================================
 AutoParkingSystem::~AutoParkingSystem() {
-    delete[] this->trans;
 }
 
 
@@ -492,16 +1054,22 @@ string AutoParkingSystem::getPinNo() {
 string AutoParkingSystem::getVehicleType() {
     return this->vehicle_type;
 }
+string AutoParkingSystem::getSite() {
+    return this->site;
+}
+string AutoParkingSystem::getBayType() {
+    return this->bay_type;
+}
 time_t AutoParkingSystem::getDateTimeIn() {
     return this->date_time_in;
 }
 time_t AutoParkingSystem::getDateTimeOut() {
     return this->date_time_out;
 }
-double AutoParkingSystem::getDuration() {
+int64_t AutoParkingSystem::getDuration() {
     return this->duration;
 }
-double AutoParkingSystem::getCharges() {
+Money AutoParkingSystem::getCharges() {
     return this->total_charges;
 }
 u32 AutoParkingSystem::getTotalLines() {
@@ -510,9 +1078,22 @@ u32 AutoParkingSystem::getTotalLines() {
 bool AutoParkingSystem::isNewPlateNo() {
     return this->new_plate_no;
 }
+bool AutoParkingSystem::isBookingMoved() {
+    return this->booking_moved;
+}
 bool AutoParkingSystem::isCorrectPinNo() {
     return this->correct_pin;
 }
+string AutoParkingSystem::getInputError() {
+    return this->input_error;
+}
+// Check whether plate_no is currently parked, call after readFile()
+bool AutoParkingSystem::hasPlateNo() {
+    for (int i = 0; i < this->total_lines; ++i)
+        if (this->trans[i].plate_no.compare(this->plate_no) == 0)
+            return true;
+    return false;
+}
 
 
 // Get 1D array of all data in the file, return a pointer
@@ -561,4 +1142,221 @@ string AutoParkingSystem::getPlateByLotNo(string lotNo) {
 string AutoParkingSystem::getLotByPlateNo(string plateNo) {
     AutoParkingSystem::sortByPlateNo();
     return AutoParkingSystem::searchBy("PLATE_NO", plateNo);
-}
\ No newline at end of file
+}
+
+
+// Parked plates within PLATE_MAX_EDITS of a plate, call after readFile().
+// The index is made once per read, not per search
+//==============================================================
+vector<string> AutoParkingSystem::findSimilarPlates(string plateNo) {
+    if (!this->is_plate_indexed) {
+        this->plate_index = PlateIndex();
+        this->plate_pins.clear();
+        for (int i = 0; i < this->total_lines; ++i) {
+            this->plate_index.add(this->trans[i].plate_no);
+            this->plate_pins[this->trans[i].plate_no] = this->trans[i].pin_no;
+        }
+        this->is_plate_indexed = true;
+    }
+    return this->plate_index.search(this->formatString(plateNo),
+                                    PLATE_MAX_EDITS);
+}
+
+//==============================================================
+//     Site helpers, shared by the class and the main program   //
+//==============================================================
+
+
+// Name of a status for receipts & the batch commands
+//==============================================================
+string statusName(ApsStatus status) {
+    switch (status) {
+        case APS_OK: return "OK";
+        case APS_INVALID_INPUT: return "INVALID_INPUT";
+        case APS_ALREADY_PARKED: return "ALREADY_PARKED";
+        case APS_NOT_PARKED: return "NOT_PARKED";
+        case APS_INVALID_PIN: return "INVALID_PIN";
+        case APS_FULL: return "FULL";
+        case APS_STORAGE_ERROR: return "STORAGE_ERROR";
+    }
+    return "UNKNOWN";
+}
+
+
+// Quoted JSON string: quotes, backslashes & control characters are
+// escaped, so any plate or site read from outside stays one value
+//==============================================================
+string jsonString(string s) {
+    const char hexDigits[] = "0123456789abcdef";
+    string quoted = "\"";
+    for (string::size_type i = 0; i < s.length(); ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (c == '\n') {
+            quoted += "\\n";
+        } else if (c == '\t') {
+            quoted += "\\t";
+        } else if (c < 0x20) {
+            quoted += "\\u00";
+            quoted += hexDigits[c >> 4];
+            quoted += hexDigits[c & 0xf];
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + '"';
+}
+
+
+// Car tariff band (index of CAR_BAND_RATE) of an hour of the day
+//==============================================================
+int carBandOfHour(int hour) {
+    int band = 0;
+    while (hour >= CAR_BAND_END[band]) ++band;
+    return band;
+}
+
+
+// Lot number for floor(0 = 'A') and lot(1 - 10), e.g. A01, and back
+//==============================================================
+string makeLotNo(int floor, int lot) {
+    string lotNo = "";
+    lotNo += (char)('A' + floor);
+    if (lot < 10) lotNo += '0';
+    lotNo += to_string(lot);
+    return lotNo;
+}
+bool parseLotNo(string lotNo, int &floor, int &lot) {
+    if (lotNo.length() != 3 || !isdigit(lotNo[1]) || !isdigit(lotNo[2]))
+        return false;
+    floor = lotNo[0] - 'A';
+    lot = atoi(lotNo.c_str() + 1);
+    return floor >= 0 && floor < TOTAL_FLOOR &&
+           lot >= 1 && lot <= TOTAL_LOT_PER_FLOOR;
+}
+
+
+// Site names are letters & digits only, empty is the main site
+//==============================================================
+bool isValidSite(string site) {
+    for (string::size_type i = 0; i < site.length(); ++i)
+        if (!isalnum((unsigned char)site[i]))
+            return false;
+    return true;
+}
+
+
+FileStamp stampFile(string fileName) {
+    FileStamp stamp;
+    struct stat info;
+    stamp.size = -1;
+    stamp.mtime_ns = 0;
+    stamp.inode = 0;
+    if (fileName.empty() || stat(fileName.c_str(), &info) != 0)
+        return stamp;
+    stamp.size = info.st_size;
+    stamp.mtime_ns = info.st_mtim.tv_sec * 1000000000LL +
+                     info.st_mtim.tv_nsec;
+    stamp.inode = info.st_ino;
+    return stamp;
+}
+
+
+bool isSameStamp(const FileStamp &s1, const FileStamp &s2) {
+    return s1.size == s2.size && s1.mtime_ns == s2.mtime_ns &&
+           s1.inode == s2.inode;
+}
+
+
+string makeTempName(string fileName) {
+    string pattern = fileName + ".XXXXXX";
+    vector<char> tempName(pattern.begin(), pattern.end());
+    tempName.push_back('\0');
+    int fd = mkstemp(&tempName[0]);
+    if (fd < 0) return "";
+    // mkstemp makes it 0600, keep the mode of the file it replaces
+    struct stat info;
+    fchmod(fd, stat(fileName.c_str(), &info) == 0 ? info.st_mode & 07777
+                                                   : 0644);
+    close(fd);
+    return string(&tempName[0]);
+}
+
+
+// Move a fully written temp file over fileName in one step
+//==============================================================
+bool replaceFile(string tempName, string fileName) {
+    return rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+
+// Prefix fileName with the site so every site has its own files,
+// the files of a scratch site go to the scratch directory
+//==============================================================
+string siteFileName(string site, string fileName) {
+    if (site.empty()) return fileName;
+    if (isScratchSite(site))
+        return scratchDir() + '/' + site.substr(1) + '_' + fileName;
+    return site + '_' + fileName;
+}
+
+
+// Scratch sites start with a mark no user site can have
+//==============================================================
+bool isScratchSite(string site) {
+    return site.length() > 1 && site[0] == SCRATCH_SITE_MARK &&
+           isValidSite(site.substr(1));
+}
+string makeScratchSite(string name) {
+    return SCRATCH_SITE_MARK + name;
+}
+
+
+// Temp directory made on first use, removed when the program exits
+//==============================================================
+static char scratch_dir[256] = "";
+static once_flag scratch_once;
+static void removeScratchDir() {
+    clearScratchSites();
+    rmdir(scratch_dir);
+}
+static void makeScratchDir() {
+    const char *tmpDir = getenv("TMPDIR");
+    string pattern = string(tmpDir && *tmpDir ? tmpDir : "/tmp") +
+                     "/apsXXXXXX";
+    if (pattern.length() >= sizeof(scratch_dir)) pattern = "/tmp/apsXXXXXX";
+    pattern.copy(scratch_dir, pattern.length());
+    scratch_dir[pattern.length()] = '\0';
+    if (mkdtemp(scratch_dir) == NULL) {
+        // Fall back to a directory of the working directory
+        pattern = "apsXXXXXX";
+        pattern.copy(scratch_dir, pattern.length());
+        scratch_dir[pattern.length()] = '\0';
+        mkdtemp(scratch_dir);
+    }
+    atexit(removeScratchDir);
+}
+string scratchDir() {
+    call_once(scratch_once, makeScratchDir);
+    return scratch_dir;
+}
+
+
+// Delete the files of every scratch site, the directory stays
+//==============================================================
+void clearScratchSites() {
+    if (scratch_dir[0] == '\0') return;
+    // A compaction would write into files being removed
+    waitForCompactions();
+    DIR *dir = opendir(scratch_dir);
+    if (dir == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if (name.compare(".") != 0 && name.compare("..") != 0)
+            remove((string(scratch_dir) + '/' + name).c_str());
+    }
+    closedir(dir);
+}
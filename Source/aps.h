@@ -1,68 +1,269 @@
+#ifndef APS_H
+#define APS_H
+#include <cstdint>
+#include <ctime>
+#include <istream>
+#include <memory>
+#include <ostream>
 #include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "money.h"
+#include "plate.h"
+#include "storage.h"
 typedef unsigned int u32;
+class BayAllocator;
+
+// Lots of each vehicle type: floor A-J, lot 01-10
+const int TOTAL_FLOOR = 10;
+const int TOTAL_LOT_PER_FLOOR = 10;
+const int TOTAL_ALL_LOT = TOTAL_FLOOR * TOTAL_LOT_PER_FLOOR;
+
+// Reservations: lots booked within the next 3h are kept free, and
+// a booked vehicle may come 30m before its booking starts
+const int RESERVATION_HOLD = 3 * 3600;
+const int RESERVATION_EARLY = 30 * 60;
+
+// Car rates (sen/hr) by band of hours, counted again every 24 hours:
+// 1st - 3rd hr, 4th & 5th hr, 6th - 9th hr, 10th - 18th hr, 19th - 24th hr
+const int TOTAL_CAR_BAND = 5;
+const int CAR_BAND_END[TOTAL_CAR_BAND] = { 3, 5, 9, 18, 24 };
+const Money CAR_BAND_RATE[TOTAL_CAR_BAND] = { 450, 350, 300, 200, 0 };
+// Motorcycle rates (sen/day)
+const Money MOTO_DAY_RATE = 200;
+
+// Outcome of parking or unparking, nothing is printed by the class
+enum ApsStatus {
+    APS_OK,
+    APS_INVALID_INPUT,
+    APS_ALREADY_PARKED,
+    APS_NOT_PARKED,
+    APS_INVALID_PIN,
+    APS_FULL,
+    APS_STORAGE_ERROR
+};
+
+// Size, modification time & inode of a file, to tell whether it was
+// written since (size -1 if it is missing)
+struct FileStamp {
+    int64_t size;
+    int64_t mtime_ns;
+    uint64_t inode;
+};
+FileStamp stampFile(std::string);
+bool isSameStamp(const FileStamp &, const FileStamp &);
+
+// One stay of a vehicle, finished or still parked
+struct Stay {
+    std::string lot_no;
+    std::string plate_no;
+    std::string vehicle_type;
+    time_t date_time_in;
+    time_t date_time_out;
+    Money charges;
+    bool is_parked;
+};
 
 class AutoParkingSystem
 {
     public:
         AutoParkingSystem();
+        // Pick the storage backend before any readFile()
+        static void setStorageType(std::string);
         // Set data members
         void setPlateNo(std::string);
         void setPinNo(std::string);
         void setLotNo(std::string);
         void setVehicleType(std::string);
-        // Must call these 3 methods in sequence
+        void setSite(std::string);
+        void setBayType(std::string);
+        void setDateTime(time_t);
+        // Must call these 3 methods in sequence, writeFile() parks a
+        // new plate_no or unparks one already in the file. readFile()
+        // is false if the store can't be read (e.g. a corrupt journal),
+        // & writeFile() & writeAll() then leave it alone
         bool validateInput();
-        void readFile();
-        void writeFile();
+        bool readFile();
+        ApsStatus writeFile();
+        // Or do all 3 for one direction only, unpark() takes a misread
+        // plate_no as the one close parked plate that accepts the PIN.
+        // These hold the lock of the files while reading & writing
+        ApsStatus park();
+        ApsStatus unpark();
+        // Lock the files of this site & vehicle type until unlockFiles()
+        // or the end of the object: the gates of other processes wait
+        // rather than read what is about to change. Take it before
+        // readFile() to writeFile() or reserveLot() after it
+        void lockFiles();
+        void unlockFiles();
         // Get everything
         std::string getPlateNo();
         std::string getPinNo();
         std::string getLotNo();
         std::string getVehicleType();
+        std::string getSite();
+        std::string getBayType();
         time_t getDateTimeIn();
         time_t getDateTimeOut();
-        double getDuration();
-        double getCharges();
+        int64_t getDuration();
+        Money getCharges();
         bool isNewPlateNo();
         bool isCorrectPinNo();
+        bool hasPlateNo();
+        // Why validateInput() failed, one message per line
+        std::string getInputError();
         u32 getTotalLines();
         std::string *getAllLotNo(std::string *);
         std::string *getAllPlateNo(std::string *);
         time_t *getAllDateTimeIn(time_t *);
-        // Sort all data in the file
+        // Sort the data read from the file, the file is not changed
         void sortByPlateNo();
         void sortByLotNo();
         void sortByDateTimeIn();
         // Search data from the file
         std::string getLotByPlateNo(std::string);
         std::string getPlateByLotNo(std::string);
+        // Parked plates close to a (mis)read plate, nearest first
+        std::vector<std::string> findSimilarPlates(std::string);
+        // Reserve a lot ahead of time, call after readFile(). A plate
+        // can't hold bookings that overlap
+        std::string findFreeLot(time_t, time_t);
+        bool reserveLot(time_t, time_t);
+        // Book the lots of stays (e.g. from getAllBookings()) in one
+        // write, stays that clash are skipped, returns how many booked
+        int addBookings(const std::vector<Stay> &);
+        // Whether park() found the booked lot still taken by another
+        // vehicle & gave the vehicle another lot
+        bool isBookingMoved();
+        // Finished & current stays for reports, call after readFile()
+        void getAllStays(std::vector<Stay> &);
+        void getParkedStays(std::vector<Stay> &);
+        void getAllBookings(std::vector<Stay> &);
+        void getFreeLots(uint16_t *);
+        // Bay layout of this site & vehicle type with the parked
+        // vehicles taken out, call after readFile(). False if the
+        // layout has a bad line, every lot is then a standard bay
+        bool loadBays(BayAllocator &);
+        // Binary snapshot of this site & vehicle type, read back as the
+        // given snapshot version. The finished stays are kept apart
+        void writeSnapshot(std::ostream &);
+        bool readSnapshot(std::istream &, uint32_t);
+        void writeHistory(std::ostream &);
+        bool readHistory(std::istream &);
+        // Replace the files with what is held in memory
+        void writeAll();
+        // Keep what was read from a snapshot for readFile(), which uses
+        // it in place of the files while they are as they were when the
+        // snapshot read them. Call before any threads are started
+        static void cacheSnapshot(std::vector<AutoParkingSystem> &);
+        // Throw away every vehicle, booking & finished stay of this
+        // site & vehicle type, call after readFile()
+        void clearAll();
         ~AutoParkingSystem();
     protected:
         std::string formatString(std::string);
+        std::string getFileName();
+        std::string getBookingFileName();
+        std::string getHistoryFileName();
+        void readBookings();
+        void writeBookings();
+        bool isBooked(std::string, time_t, time_t);
+        bool isOccupied(std::string);
+        bool hasBooking(std::string, time_t, time_t);
+        bool insertBooking(std::string, std::string, time_t, time_t);
+        bool takeBooking(std::string &);
+        bool resolvePlateNo();
         void genLotNo();
         void calcDuration();
         void calcCharges();
-        void swapStr(std::string *, std::string *);
-        void swapTime(time_t *, time_t *);
         void sortBy(std::string);
         std::string searchBy(std::string, std::string);
     private:
-        struct Transport {
-            std::string lot_no;
+        struct Booking {
             std::string plate_no;
-            time_t date_time_in;
-            std::string pin_no;
+            time_t start;
+            time_t end;
+        };
+        // Where the bookings of a plate are, by lot & start
+        struct PlateBooking {
+            std::string lot_no;
+            time_t start;
+            time_t end;
         };
-        Transport *trans;
+        // A site & vehicle type as a snapshot found it
+        struct CachedState {
+            FileStamp store_stamp;
+            FileStamp booking_stamp;
+            std::vector<Transport> trans;
+            std::map<std::string, std::vector<Booking> > bookings;
+            std::multimap<std::string, PlateBooking> plate_bookings;
+        };
+        static std::map<std::string, CachedState> snapshot_cache;
+        static bool isLessPlateNo(const Transport &, const Transport &);
+        static bool isLessLotNo(const Transport &, const Transport &);
+        static bool isEarlierIn(const Transport &, const Transport &);
+        static bool isEarlierBooking(const Booking &, const Booking &);
+        static bool isEarlierEnd(const Booking &, const Booking &);
+        static std::string storage_type;
+        std::unique_ptr<Storage> storage;
+        std::unique_ptr<FileLock> file_lock;
+        std::vector<Transport> trans;
+        std::map<std::string, std::vector<Booking> > bookings;
+        std::multimap<std::string, PlateBooking> plate_bookings;
+        std::vector<std::string> history;
+        // Parked plates & their PINs for misread plates, built by the
+        // first findSimilarPlates() after the records are read
+        PlateIndex plate_index;
+        std::unordered_map<std::string, std::string> plate_pins;
+        bool is_plate_indexed;
+        FileStamp store_stamp;
+        FileStamp booking_stamp;
         std::string plate_no;
         std::string pin_no;
         std::string lot_no;
         std::string vehicle_type;
+        std::string site;
+        std::string bay_type;
+        std::string input_error;
         time_t date_time_in;
         time_t date_time_out;
-        double duration;
-        double total_charges;
+        int64_t duration;     // Seconds
+        Money total_charges;
         u32 total_lines;
         bool new_plate_no;
         bool correct_pin;
-};
\ No newline at end of file
+        bool booking_moved;
+        bool booking_taken;   // By genLotNo(), saved once parked
+        bool has_history;
+        bool store_failed;
+};
+
+// Name of a status, e.g. "INVALID_PIN"
+std::string statusName(ApsStatus);
+// Value as a quoted JSON string, e.g. a"b -> "a\"b"
+std::string jsonString(std::string);
+// Sites (garages) share the program but each has its own files
+bool isValidSite(std::string);
+std::string siteFileName(std::string, std::string);
+// Throwaway sites of bench, perf & replay, e.g. "_bench": no user site
+// can be named like one, & their files are kept in a temp directory
+// that is removed when the program exits
+const char SCRATCH_SITE_MARK = '_';
+bool isScratchSite(std::string);
+std::string makeScratchSite(std::string);
+std::string scratchDir();
+void clearScratchSites();
+// Name of a new empty temp file next to a file (mkstemp), unique
+// across processes & with the mode of the file it will replace. Empty
+// if none could be made
+std::string makeTempName(std::string);
+// Replace a file with a fully written temp file
+bool replaceFile(std::string, std::string);
+// Lot number for floor & lot, e.g. (0, 1) is A01, and back again
+std::string makeLotNo(int, int);
+bool parseLotNo(std::string, int &, int &);
+// Car tariff band of an hour of the day (0 - 23)
+int carBandOfHour(int);
+
+#endif
@@ -0,0 +1,242 @@
+#include <chrono>        // milliseconds
+#include <cstdio>        // EOF, remove
+#include <cstring>       // memcmp
+#include <fstream>       // ifstream, ofstream
+#include <iomanip>       // put_time
+#include <iostream>      // cout
+#include <mutex>         // mutex
+#include <utility>       // swap
+#include <vector>        // vector
+#include "aps.h"
+#include "audit.h"
+#include "snapshot.h"
+using namespace std;
+
+AuditLog audit;
+
+
+//  Constructor: every slot starts out free for the pass of head
+//==============================================================
+AuditLog::AuditLog(string fileName)
+    : file_name(fileName), head(0), tail(0), total_pushed(0),
+      total_written(0), enabled(true), started(false), stopping(false) {
+    for (uint32_t i = 0; i < RING_SIZE; ++i)
+        this->ring[i].seq.store(i, memory_order_relaxed);
+}
+
+
+// Hand a record to the writer thread, never blocks on the file
+//==============================================================
+bool AuditLog::record(AuditKind kind, time_t when, string site,
+                      string subject, string lotNo) {
+    if (!this->enabled.load(memory_order_relaxed)) return true;
+    // A name readAuditRecord() would take for a corrupt length
+    if (site.length() > MAX_BIN_STR || subject.length() > MAX_BIN_STR ||
+        lotNo.length() > MAX_BIN_STR)
+        return false;
+    if (!this->started.load(memory_order_acquire)) this->start();
+
+    // Claim a slot: its seq equals the position when it is free
+    uint64_t pos = this->head.load(memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &this->ring[pos & (RING_SIZE - 1)];
+        uint64_t seq = slot->seq.load(memory_order_acquire);
+        if (seq == pos) {
+            if (this->head.compare_exchange_weak(pos, pos + 1,
+                                                 memory_order_relaxed))
+                break;
+        } else if (seq < pos) {
+            // Ring is full, wait for the writer to free a slot
+            this_thread::yield();
+            pos = this->head.load(memory_order_relaxed);
+        } else {
+            pos = this->head.load(memory_order_relaxed);
+        }
+    }
+
+    // The slot is ours until published, its strings are reused
+    AuditRecord &rec = slot->rec;
+    rec.time = when;
+    rec.kind = kind;
+    rec.site.swap(site);
+    rec.subject.swap(subject);
+    rec.lot_no.swap(lotNo);
+    // Publish the slot to the writer
+    slot->seq.store(pos + 1, memory_order_release);
+    this->total_pushed.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+
+// Take the next published record, writer thread only
+//==============================================================
+bool AuditLog::pop(AuditRecord &rec) {
+    Slot &slot = this->ring[this->tail & (RING_SIZE - 1)];
+    if (slot.seq.load(memory_order_acquire) != this->tail + 1)
+        return false;
+    swap(rec, slot.rec);
+    // Free the slot for the next pass around the ring
+    slot.seq.store(this->tail + RING_SIZE, memory_order_release);
+    ++this->tail;
+    return true;
+}
+
+
+void AuditLog::start() {
+    static mutex lock;
+    lock_guard<mutex> guard(lock);
+    if (this->started.load(memory_order_relaxed)) return;
+    this->writer = thread(&AuditLog::run, this);
+    this->started.store(true, memory_order_release);
+}
+
+
+// Rewrite a version 1 audit file as version 2, a torn last record
+// is left out
+//==============================================================
+static bool convertAudit(string fileName) {
+    ifstream auditRF(fileName.c_str(), ios::binary);
+    if (readAuditVersion(auditRF) != 1) return false;
+    string tempName = makeTempName(fileName);
+    ofstream auditWF(tempName.c_str(), ios::binary);
+    auditWF.write(AUDIT_MAGIC, sizeof(AUDIT_MAGIC));
+    AuditRecord rec;
+    while (auditRF.peek() != EOF && readAuditRecord(auditRF, 1, rec))
+        writeAuditRecord(auditWF, rec);
+    auditWF.close();
+    if (!auditWF.good() || !replaceFile(tempName, fileName)) {
+        remove(tempName.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// Writer thread: drain the ring to the file until stopped
+//==============================================================
+void AuditLog::run() {
+    // New (or empty) file gets the magic first, an old one is converted
+    ifstream auditRF(this->file_name.c_str(), ios::binary);
+    bool isNew = auditRF.peek() == EOF;
+    int version = isNew ? 0 : readAuditVersion(auditRF);
+    auditRF.close();
+    if (version == 1) convertAudit(this->file_name);
+    ofstream auditWF(this->file_name.c_str(), ios::binary | ios::app);
+    if (isNew) auditWF.write(AUDIT_MAGIC, sizeof(AUDIT_MAGIC));
+
+    AuditRecord rec;
+    while (true) {
+        bool isStopping = this->stopping.load(memory_order_acquire);
+        int total = 0;
+        while (this->pop(rec)) {
+            writeAuditRecord(auditWF, rec);
+            ++total;
+        }
+        if (total > 0) {
+            auditWF.flush();
+            this->total_written.fetch_add(total, memory_order_release);
+        } else if (isStopping) {
+            // Ring was drained after the stop was seen
+            break;
+        } else {
+            this_thread::sleep_for(chrono::milliseconds(2));
+        }
+    }
+}
+
+
+void AuditLog::flush() {
+    if (!this->started.load(memory_order_acquire)) return;
+    uint64_t pushed = this->total_pushed.load(memory_order_relaxed);
+    while (this->total_written.load(memory_order_acquire) < pushed)
+        this_thread::sleep_for(chrono::milliseconds(1));
+}
+
+
+void AuditLog::setEnabled(bool isEnabled) {
+    this->enabled.store(isEnabled, memory_order_relaxed);
+}
+
+
+AuditLog::~AuditLog() {
+    if (!this->started.load(memory_order_acquire)) return;
+    this->stopping.store(true, memory_order_release);
+    this->writer.join();
+}
+
+
+//==============================================================
+
+
+string auditKindName(uint8_t kind) {
+    switch (kind) {
+        case AUDIT_PARK: return "PARK";
+        case AUDIT_UNPARK: return "UNPARK";
+        case AUDIT_PIN_FAIL: return "PIN_FAIL";
+        case AUDIT_ADMIN_OK: return "ADMIN_OK";
+        case AUDIT_ADMIN_FAIL: return "ADMIN_FAIL";
+    }
+    return "UNKNOWN";
+}
+
+
+int readAuditVersion(istream &in) {
+    char magic[sizeof(AUDIT_MAGIC)];
+    if (!in.read(magic, sizeof(magic))) return 0;
+    if (memcmp(magic, AUDIT_MAGIC_V1, sizeof(magic)) == 0) return 1;
+    if (memcmp(magic, AUDIT_MAGIC, sizeof(magic)) == 0) return 2;
+    return 0;
+}
+
+
+// Next record, false at a torn or corrupt one. Version 1 fields have
+// a length byte, version 2 fields a 32-bit length
+//==============================================================
+bool readAuditRecord(istream &in, int version, AuditRecord &rec) {
+    int64_t when;
+    char kind, len, buf[256];
+    if (!readBin(in, when) || !in.get(kind)) return false;
+    rec.time = when;
+    rec.kind = kind;
+    string *fields[3] = { &rec.site, &rec.subject, &rec.lot_no };
+    for (int i = 0; i < 3; ++i) {
+        if (version != 1) {
+            if (!readBinStr(in, *fields[i])) return false;
+        } else {
+            if (!in.get(len) || !in.read(buf, (uint8_t)len)) return false;
+            fields[i]->assign(buf, (uint8_t)len);
+        }
+    }
+    return true;
+}
+
+
+void writeAuditRecord(ostream &out, const AuditRecord &rec) {
+    writeBin<int64_t>(out, rec.time);
+    out.put(rec.kind);
+    writeBinStr(out, rec.site);
+    writeBinStr(out, rec.subject);
+    writeBinStr(out, rec.lot_no);
+}
+
+
+bool printAudit(istream &in) {
+    int version = readAuditVersion(in);
+    if (version == 0) return false;
+
+    AuditRecord rec;
+    while (in.peek() != EOF) {
+        if (!readAuditRecord(in, version, rec))
+            return false;   // Torn last record
+        time_t t = rec.time;
+        struct tm tmWhen;
+        localtime_r(&t, &tmWhen);
+        cout << put_time(&tmWhen, "%d-%m-%Y %H:%M:%S") << ' '
+             << auditKindName(rec.kind) << ' '
+             << (rec.site.empty() ? "-" : rec.site) << ' '
+             << rec.subject << ' '
+             << (rec.lot_no.empty() ? "-" : rec.lot_no) << endl;
+    }
+    return true;
+}
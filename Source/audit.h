@@ -0,0 +1,87 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <thread>
+
+const std::string AUDIT_FILE = "audit.dat";
+// Version 1 kept each field behind a length byte, version 2 behind a
+// 32-bit length. A version 1 file is converted before it is appended to
+const char AUDIT_MAGIC_V1[8] = { 'A', 'P', 'S', 'A', 'U', 'D', '1', '\0' };
+const char AUDIT_MAGIC[8] = { 'A', 'P', 'S', 'A', 'U', 'D', '2', '\0' };
+
+// What an audit record is about
+enum AuditKind {
+    AUDIT_PARK = 1,
+    AUDIT_UNPARK,
+    AUDIT_PIN_FAIL,
+    AUDIT_ADMIN_OK,
+    AUDIT_ADMIN_FAIL
+};
+
+// One audit record, subject is the plate no or the admin username.
+// Names are kept whole, up to MAX_BIN_STR bytes each
+struct AuditRecord {
+    int64_t time;
+    uint8_t kind;
+    std::string site;
+    std::string subject;
+    std::string lot_no;
+};
+
+// Audit records are handed to a background thread through a bounded
+// lock-free ring buffer, then appended to the audit file in binary:
+//   magic, then per record: time (int64), kind (uint8), and site,
+//   subject & lot no each as a 32-bit length followed by the bytes
+// A full ring makes the caller wait for a free slot, nothing is dropped
+class AuditLog
+{
+    public:
+        explicit AuditLog(std::string = AUDIT_FILE);
+        // False (& nothing recorded) only for a name too long to be
+        // read back
+        bool record(AuditKind, time_t, std::string, std::string,
+                    std::string);
+        // Write out every record handed in so far
+        void flush();
+        // Drop records from now on (or keep them again)
+        void setEnabled(bool);
+        ~AuditLog();
+    private:
+        static const uint32_t RING_SIZE = 4096;   // Power of 2
+        struct Slot {
+            std::atomic<uint64_t> seq;
+            AuditRecord rec;
+        };
+        void start();
+        void run();
+        bool pop(AuditRecord &);
+        std::string file_name;
+        Slot ring[RING_SIZE];
+        std::atomic<uint64_t> head;   // Next slot to fill
+        uint64_t tail;                // Next slot to write, writer only
+        std::atomic<uint64_t> total_pushed;
+        std::atomic<uint64_t> total_written;
+        std::atomic<bool> enabled;
+        std::atomic<bool> started;
+        std::atomic<bool> stopping;
+        std::thread writer;
+};
+
+// Audit log of the program, shared by every site
+extern AuditLog audit;
+
+// Print the records of an audit file, one per line
+bool printAudit(std::istream &);
+std::string auditKindName(uint8_t);
+// Version of an audit file from its magic (0 if not one), & its
+// records one at a time in that version
+int readAuditVersion(std::istream &);
+bool readAuditRecord(std::istream &, int, AuditRecord &);
+void writeAuditRecord(std::ostream &, const AuditRecord &);
+
+#endif
@@ -0,0 +1,196 @@
+#include <cstdlib>       // posix_memalign, free
+#include <new>           // bad_alloc
+#include <sstream>       // istringstream
+#include <vector>        // vector
+#include "bay.h"
+using namespace std;
+
+const string BAY_TYPE_NAME[TOTAL_BAY_TYPE] = {
+    "STANDARD", "COMPACT", "EV", "ACCESSIBLE", "OVERSIZE"
+};
+// Bay types each type may use, best fit first, ended by -1
+const int BAY_FALLBACK[TOTAL_BAY_TYPE][4] = {
+    { BAY_STANDARD, BAY_OVERSIZE, -1 },
+    { BAY_COMPACT, BAY_STANDARD, BAY_OVERSIZE, -1 },
+    { BAY_EV, BAY_STANDARD, BAY_OVERSIZE, -1 },
+    { BAY_ACCESSIBLE, BAY_STANDARD, BAY_OVERSIZE, -1 },
+    { BAY_OVERSIZE, -1 }
+};
+
+
+string bayTypeName(int type) {
+    if (type < 0 || type >= TOTAL_BAY_TYPE) return "N/A";
+    return BAY_TYPE_NAME[type];
+}
+int bayTypeOf(string name) {
+    for (int type = 0; type < TOTAL_BAY_TYPE; ++type)
+        if (name.compare(BAY_TYPE_NAME[type]) == 0) return type;
+    return -1;
+}
+
+
+//  Constructor: every lot a free standard bay
+//==============================================================
+BayAllocator::BayAllocator() {
+    for (int type = 0; type < TOTAL_BAY_TYPE; ++type)
+        this->total[type] = 0;
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor) {
+        Floor &shard = this->floors[floor];
+        for (int type = 0; type < TOTAL_BAY_TYPE; ++type)
+            shard.free_lots[type] = 0;
+        for (int lot = 0; lot < TOTAL_LOT_PER_FLOOR; ++lot)
+            shard.bay_type[lot] = BAY_STANDARD;
+        shard.free_lots[BAY_STANDARD] = (1 << TOTAL_LOT_PER_FLOOR) - 1;
+    }
+    this->total[BAY_STANDARD] = TOTAL_ALL_LOT;
+}
+
+
+// Allocators on the heap, aligned to a cache line like on the stack
+//==============================================================
+void *BayAllocator::operator new(size_t size) {
+    void *memory;
+    if (posix_memalign(&memory, CACHE_LINE, size) != 0) throw bad_alloc();
+    return memory;
+}
+void *BayAllocator::operator new[](size_t size) {
+    return BayAllocator::operator new(size);
+}
+void BayAllocator::operator delete(void *memory) {
+    free(memory);
+}
+void BayAllocator::operator delete[](void *memory) {
+    free(memory);
+}
+
+
+// Read the layout, call before any take(), false on a bad line
+//==============================================================
+bool BayAllocator::loadLayout(istream &in, string vehicleType) {
+    string line, vehType, lotNo, typeName;
+    int floor, lot;
+    // Bays are only set once every line has been read
+    vector<int> layout;
+    while (getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        if (!(ss >> vehType)) continue;
+        if (!(ss >> lotNo >> typeName) ||
+            !parseLotNo(lotNo, floor, lot) || bayTypeOf(typeName) < 0)
+            return false;
+        if (vehType.compare(vehicleType) != 0) continue;
+        layout.push_back(floor);
+        layout.push_back(lot);
+        layout.push_back(bayTypeOf(typeName));
+    }
+    for (int i = 0; i < (int)layout.size(); i += 3)
+        this->setBayType(layout[i], layout[i + 1], layout[i + 2]);
+    return true;
+}
+
+
+// Floor 0 - 9, lot 1 - 10 like makeLotNo()
+//==============================================================
+void BayAllocator::setBayType(int floor, int lot, int type) {
+    Floor &shard = this->floors[floor];
+    int oldType = shard.bay_type[lot - 1];
+    uint16_t bit = 1 << (lot - 1);
+    bool isFree = (shard.free_lots[oldType] & bit) != 0;
+    // Move the bay, free or taken, from its old type to the new one
+    shard.free_lots[oldType] &= ~bit;
+    --this->total[oldType];
+    shard.bay_type[lot - 1] = type;
+    ++this->total[type];
+    if (isFree) shard.free_lots[type] |= bit;
+}
+int BayAllocator::getBayType(int floor, int lot) {
+    return this->floors[floor].bay_type[lot - 1];
+}
+
+
+bool BayAllocator::canUse(int need, int floor, int lot) {
+    if (need < 0 || need >= TOTAL_BAY_TYPE) return false;
+    for (int i = 0; BAY_FALLBACK[need][i] >= 0; ++i)
+        if (BAY_FALLBACK[need][i] == this->floors[floor].bay_type[lot - 1])
+            return true;
+    return false;
+}
+
+
+void BayAllocator::take(int floor, int lot) {
+    Floor &shard = this->floors[floor];
+    shard.free_lots[shard.bay_type[lot - 1]] &= ~(1 << (lot - 1));
+}
+void BayAllocator::release(int floor, int lot) {
+    Floor &shard = this->floors[floor];
+    shard.free_lots[shard.bay_type[lot - 1]] |= 1 << (lot - 1);
+}
+
+
+// Random floor among those with a free bay of the best type that has
+// one, then a random free lot on it. The floors with one are gathered
+// as the pick is made, no bitmap spans the floors
+//==============================================================
+bool BayAllocator::allocate(int need, int &floor, int &lot, Random &rng) {
+    if (need < 0 || need >= TOTAL_BAY_TYPE) return false;
+    for (int i = 0; BAY_FALLBACK[need][i] >= 0; ++i) {
+        int type = BAY_FALLBACK[need][i];
+        uint16_t freeFloors = 0;
+        for (int f = 0; f < TOTAL_FLOOR; ++f)
+            if (this->floors[f].free_lots[type]) freeFloors |= 1 << f;
+        if (freeFloors == 0) continue;
+        floor = pickBit(freeFloors, rng);
+        lot = pickBit(this->floors[floor].free_lots[type], rng) + 1;
+        this->take(floor, lot);
+        return true;
+    }
+    return false;
+}
+
+
+// Touches the shard of that floor only
+//==============================================================
+bool BayAllocator::allocateOnFloor(int need, int floor, int &lot,
+                                   Random &rng) {
+    if (need < 0 || need >= TOTAL_BAY_TYPE) return false;
+    Floor &shard = this->floors[floor];
+    for (int i = 0; BAY_FALLBACK[need][i] >= 0; ++i) {
+        int type = BAY_FALLBACK[need][i];
+        if (shard.free_lots[type] == 0) continue;
+        lot = pickBit(shard.free_lots[type], rng) + 1;
+        shard.free_lots[type] &= ~(1 << (lot - 1));
+        return true;
+    }
+    return false;
+}
+
+
+// Index of a random set bit
+//==============================================================
+int BayAllocator::pickBit(uint16_t bits, Random &rng) {
+    int totalBits = 0;
+    for (uint16_t rest = bits; rest; rest &= rest - 1)
+        ++totalBits;
+    int skip = rng.next(totalBits);
+    for (int i = 0; i < skip; ++i)
+        bits &= bits - 1;
+    int index = 0;
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        ++index;
+    }
+    return index;
+}
+
+
+int BayAllocator::getTotal(int type) {
+    return this->total[type];
+}
+int BayAllocator::getUsed(int type) {
+    int totalFree = 0;
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor)
+        for (uint16_t rest = this->floors[floor].free_lots[type]; rest;
+             rest &= rest - 1)
+            ++totalFree;
+    return this->total[type] - totalFree;
+}
@@ -0,0 +1,78 @@
+#ifndef BAY_H
+#define BAY_H
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include "aps.h"
+#include "clock.h"
+
+// Kinds of bay, every lot is a standard bay unless bays.dat says so
+enum BayType {
+    BAY_STANDARD,
+    BAY_COMPACT,
+    BAY_EV,
+    BAY_ACCESSIBLE,
+    BAY_OVERSIZE
+};
+const int TOTAL_BAY_TYPE = 5;
+const std::string BAYS_FILE = "bays.dat";
+const size_t CACHE_LINE = 64;
+
+// Name of a bay type & back, -1 if unknown
+std::string bayTypeName(int);
+int bayTypeOf(std::string);
+
+// Free bays of one site & vehicle type as a bitmap of lots per floor
+// for every bay type, so a pick looks at a fixed number of words
+// whatever the occupancy. Each floor is a shard that shares nothing
+// with the others (not even a cache line): once the layout is loaded,
+// threads may take, release & allocate on different floors at once.
+// new aligns an allocator to its cache lines, a std::vector of them
+// doesn't (C++11 allocates to 16 bytes only), so keep arrays of them
+// on the stack or from new[].
+// A vehicle takes a bay of the type it needs, else falls back:
+//   STANDARD   -> OVERSIZE
+//   COMPACT    -> STANDARD -> OVERSIZE
+//   EV         -> STANDARD -> OVERSIZE
+//   ACCESSIBLE -> STANDARD -> OVERSIZE
+//   OVERSIZE   -> (none)
+class BayAllocator
+{
+    public:
+        BayAllocator();
+        static void *operator new(size_t);
+        static void *operator new[](size_t);
+        static void operator delete(void *);
+        static void operator delete[](void *);
+        // Layout lines "<CAR|MOTORCYCLE> <lotNo> <bay type>", only the
+        // lines of this vehicle type are used. A bad line rejects the
+        // whole layout, nothing is changed
+        bool loadLayout(std::istream &, std::string);
+        void setBayType(int, int, int);
+        int getBayType(int, int);
+        // Whether a vehicle needing a bay type may use a floor & lot,
+        // whatever is parked there
+        bool canUse(int, int, int);
+        // Mark a bay taken or free again
+        void take(int, int);
+        void release(int, int);
+        // Random floor & lot of the best fitting free bay, false if none
+        bool allocate(int, int &, int &, Random &);
+        // Random lot of the best fitting free bay on one floor only
+        bool allocateOnFloor(int, int, int &, Random &);
+        // Occupancy of a bay type
+        int getTotal(int);
+        int getUsed(int);
+    private:
+        static int pickBit(uint16_t, Random &);
+        // One floor, aligned (so padded) to a cache line of its own
+        struct alignas(CACHE_LINE) Floor {
+            uint16_t free_lots[TOTAL_BAY_TYPE];
+            uint8_t bay_type[TOTAL_LOT_PER_FLOOR];
+        };
+        Floor floors[TOTAL_FLOOR];
+        int total[TOTAL_BAY_TYPE];
+};
+
+#endif
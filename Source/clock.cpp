@@ -0,0 +1,60 @@
+#include <chrono>        // steady_clock
+#include "clock.h"
+using namespace std;
+
+static shared_ptr<Clock> clockInUse(new SystemClock());
+static uint64_t randomSeed =
+    chrono::steady_clock::now().time_since_epoch().count() ^ time(NULL);
+
+
+time_t SystemClock::now() {
+    return time(NULL);
+}
+
+
+ManualClock::ManualClock(time_t start) : current(start) {}
+time_t ManualClock::now() {
+    return (time_t)this->current.load();
+}
+void ManualClock::set(time_t when) {
+    this->current.store(when);
+}
+
+
+void setClock(shared_ptr<Clock> newClock) {
+    atomic_store(&clockInUse, newClock);
+}
+time_t currentTime() {
+    return atomic_load(&clockInUse)->now();
+}
+
+
+//==============================================================
+Random::Random(uint64_t seed) : state(seed) {}
+uint32_t Random::next(uint32_t bound) {
+    uint64_t z = (this->state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return bound == 0 ? 0 : (uint32_t)(z % bound);
+}
+
+
+void setRandomSeed(uint64_t seed) {
+    randomSeed = seed;
+}
+uint64_t getRandomSeed() {
+    return randomSeed;
+}
+
+
+// FNV-1a of the key mixed into the seed
+//==============================================================
+Random makeRandom(string key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (string::size_type i = 0; i < key.length(); ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return Random(hash ^ randomSeed);
+}
@@ -0,0 +1,54 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+
+// Where the program gets the current time from: the wall clock unless
+// a replay moves it along with the events
+class Clock
+{
+    public:
+        virtual ~Clock() {}
+        virtual time_t now() = 0;
+};
+class SystemClock : public Clock
+{
+    public:
+        time_t now();
+};
+class ManualClock : public Clock
+{
+    public:
+        ManualClock(time_t);
+        time_t now();
+        void set(time_t);
+    private:
+        std::atomic<long long> current;
+};
+
+// Swap the clock, threads reading it meanwhile get the old or the new
+void setClock(std::shared_ptr<Clock>);
+time_t currentTime();
+
+// Small fast generator (splitmix64) for picking lots
+class Random
+{
+    public:
+        Random(uint64_t);
+        // 0 to bound - 1
+        uint32_t next(uint32_t);
+    private:
+        uint64_t state;
+};
+
+// Seed of every generator, taken from the clock at start unless given
+void setRandomSeed(uint64_t);
+uint64_t getRandomSeed();
+// Generator for one decision, made from the seed & a key saying what
+// is decided, so the result does not depend on which thread goes first
+Random makeRandom(std::string);
+
+#endif
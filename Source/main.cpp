@@ -1,15 +1,64 @@
 #include <algorithm>     // erase, remove
+#include <cctype>        // isdigit, toupper
+#include <chrono>        // steady_clock
+#include <cstdlib>       // atoi
+#include <deque>         // deque
 #include <ctime>         // time
 #include <iomanip>       // put_time c++11 (alternative: asctime)
 #include <iostream>      // cout
 #include <sstream>       // to_string c++11 (alternative: stringstream)
 #include <fstream>
+#include <functional>    // bind
+#include <future>        // async
+#include <map>           // map
+#include <set>           // set
+#include <vector>        // vector
+#include "alert.h"
+#include "audit.h"
 #include "aps.h"
+#include "bay.h"
+#include "clock.h"
+#include "plate.h"
+#include "perf.h"
+#include "pool.h"
+#include "pricing.h"
+#include "report.h"
+#include "secret.h"
+#include "snapshot.h"
 using namespace std;
 
 #define DTFORMAT "%d-%m-%Y %H:%M:%S"
+#define RESVFORMAT "%d-%m-%Y %H:%M"
 const string ADMIN_FILE = "admin.dat";
 const string SALES_FILE = "sales.dat";
+const string SITES_FILE = "sites.dat";
+const string STORAGE_FILE = "storage.dat";
+const string SNAPSHOT_FILE = "aps.snap";
+const int SNAPSHOT_PERIOD = 5 * 60;   // Take a snapshot every 5 minutes
+// Fewest bytes a site takes in a snapshot: its name, sales & 2 empty
+// shards
+const size_t MIN_SNAPSHOT_SITE = 4 + 8 + 2 * (4 + 4 + 2 * TOTAL_FLOOR);
+const int DEDUP_WINDOW = 60;   // Ignore repeat camera reads within 60s
+const int INGEST_BATCH = 4096; // Events applied per batch of ingestion
+// Replayed events go to scratch sites, e.g. north -> _replaynorth
+const string REPLAY_PREFIX = "replay";
+const uint64_t REPLAY_SEED = 1;   // Seed of a replay if none is given
+const int BENCH_MAX_SITES = 32;   // Ingestion is benched on up to 32 sites
+const int BENCH_MAX_PLATES = 200000;    // Index plates, ~3.5KB each
+const int BENCH_MAX_STAYS = 1000000;    // Stays of the scaling bench
+const int BENCH_GARAGES = 16;   // Garages of the allocation scaling bench
+const int BENCH_MAX_TOTAL = 1000000;    // Gate operations of a bench
+// Bays of each bench floor: 1 accessible, 2 EV, 3 compact, 3 standard &
+// 1 oversize bay, the bench fleet comes in the same mix
+const int BENCH_MIX[TOTAL_LOT_PER_FLOOR] = {
+    BAY_ACCESSIBLE, BAY_EV, BAY_EV, BAY_COMPACT, BAY_COMPACT,
+    BAY_COMPACT, BAY_STANDARD, BAY_STANDARD, BAY_STANDARD, BAY_OVERSIZE
+};
+
+// Site (garage) served by this session, empty for the main site
+string currentSite = "";
+// Overstay & expiring booking alerts of every site
+AlertMonitor alerts;
 
 // Real Time Embedded System
 // 1) Admin (must have username & password) can
@@ -19,22 +68,93 @@ const string SALES_FILE = "sales.dat";
 //     - search plate by lot no
 //     - search lot by plate no
 //     - view total sales
+//     - view reports (occupancy, dwell time, revenue, long stays)
+//     - find a plate & view total sales across all sites
 //     - shutdown/exit program
 // 2) User can
 //     - Enter Car: put car -> enter plateNo & PIN -> give no receipt (that's all)
 //     - Take Car: enter plateNo & PIN -> give receipt -> pay -> get car
+//     - Reserve: enter plateNo & time -> get lot no kept for the booking
+// 3) Camera (ANPR) events can be fed without the menus:
+//     - ./aps --ingest [events file]   (reads stdin if no file given)
+//     - one event per line: <epoch> <PARK|UNPARK> <CAR|MOTORCYCLE>
+//                           <plateNo> <pinNo> [site]
+//       (the --site being served if no site is given)
+//     - one receipt per event is printed as a JSON line, in the order
+//       of the events
+//     - events of different sites are applied in parallel, a worker
+//       per core takes the sites of the busier workers when idle
+//     - ./aps [--seed N] --replay [events file]   (same events again,
+//       into empty scratch sites, gives the same lots & charges)
+// 4) Several sites (garages) can be served, each with its own files:
+//     - ./aps --site <name> [...]   (main site if not given)
+//     - sites.dat lists every site other than the main site
+// 5) A snapshot of every site is saved to aps.snap every 5 minutes:
+//     - ./aps --snapshot [file]   (save one now)
+//     - ./aps --restore [file]    (put every site back as it was,
+//       finished stays included)
+//     - the menus, --ingest & --batch start from aps.snap, sites not
+//       changed since it was saved are not read again
+// 6) Parked vehicles are kept in text files or in binary journals:
+//     - ./aps --storage <text|journal> [...]   (moves every site over)
+//     - storage.dat remembers the choice
+// 7) Vehicles parked over 24h & 7 days and bookings about to end are
+//    written to alerts.log while the program runs, or when it next
+//    starts (the menus, --ingest or --batch) if nothing was checking
+// 8) Charges can follow rules in rates.dat (picked up when it changes,
+//    a file that does not parse is shown by stats & the rates before
+//    it are kept):
+//     - TIME <SUN..SAT|WEEKDAY|WEEKEND|ALL> <from hr> <to hr> <multiplier>
+//     - OCCUPANCY <percent full> <multiplier>
+// 9) Parking, unparking, wrong PINs & admin logins go to audit.dat:
+//     - ./aps --audit [file]   (print the records)
+// 10) Commands can be run without the menus, one JSON line each:
+//     - ./aps --run <command> [args]   (one command)
+//     - ./aps --batch [file]   (one command per line, stdin if no file)
+//     - park <CAR|MOTORCYCLE> <plateNo> <pinNo> [bay type]
+//       (STANDARD, COMPACT, EV, ACCESSIBLE or OVERSIZE, see bay.h)
+//     - unpark <CAR|MOTORCYCLE> <plateNo> <pinNo>
+//     - lookup <plateNo>   (lists similar parked plates if not found)
+//     - list <CAR|MOTORCYCLE>
+//     - stats
+//     - bench [operations]   (1 to 1,000,000 parks & unparks in a
+//       scratch site)
+//     - perf [scale]   (timed scenarios in scratch sites on the MockData
+//       fixtures, APS_FIXTURE_DIR if elsewhere, see perf.h)
+//     - perf record [baseline file]   (perf.json if no file)
+//     - perf check [baseline file] [threshold %]   (fails if slower)
+// 11) Lots are standard bays unless <site_>bays.dat says otherwise:
+//     - one "<CAR|MOTORCYCLE> <lotNo> <bay type>" line per bay
+// 12) Unparking a plate that is not parked (e.g. misread by a camera)
+//     takes the one parked plate within 2 edits whose PIN matches
 
 struct MyVehicle {
     string plateNo, pinNo, lotNo, vehicleType;
     time_t dateTimeIn, dateTimeOut;
-    double duration, charges;
+    int64_t duration;   // Seconds
+    Money charges;
+    bool bookingMoved;  // Booked lot was taken, parked elsewhere
 };
 
+bool loadStorage();
+bool changeStorage(string);
+bool saveSnapshot(string);
+bool readSnapshotFile(string, vector<string> &, vector<Money> &,
+                      vector<AutoParkingSystem> &, int64_t &, bool);
+bool restoreSnapshot(string);
+void loadSnapshotCache();
+void autoSnapshot();
 void initAdmin();
+void loadAdmin(string &, string &);
 bool validateAdmin();
-double calcTotalSales(double);
+Money calcTotalSales(Money, string);
+vector<string> loadSites();
+void registerSite(string);
+void findPlateAllSites(string);
+Money calcTotalSalesAllSites();
 void userMenu();
 void userFeatures(int);
+void userReserve(int);
 void showReceipt(MyVehicle);
 void adminMenu();
 void adminFeatures(int, int);
@@ -42,12 +162,133 @@ int inputOption(int, int);
 void showAtTop();
 void showAllParkingLots(string, string *, int);
 void showAllDetails(string, string *, string *, time_t *, int);
+void showReports();
 void pauseScreen();
 void clearScreen();
+void ingestEvents(istream &, ostream &, bool);
+void ingestSiteEvents(string, const vector<string> *, const vector<int> *,
+                      map<string, time_t> *, vector<string> *, bool);
+void ingestEvent(string, const string &, map<string, time_t> *, ostream &,
+                 bool);
+string replaySite(string);
+void printEventReceipt(ostream &, time_t, string, string, string, MyVehicle);
+void runBatch(istream &);
+bool runCommand(const vector<string> &, ostream &);
+bool runGate(bool, const vector<string> &, ostream &);
+bool runLookup(string, ostream &);
+void runList(string, ostream &);
+void runStats(ostream &);
+void printBays(ostream &, BayAllocator &);
+void churnFloor(BayAllocator *, int, int, const int *, int *);
+bool runBench(const vector<string> &, ostream &);
+int benchGates(string, int, ostream &);
+int benchAllocator(int, ostream &);
+int benchBilling(int, ostream &);
+int benchFuzzy(string, int, ostream &);
+int benchScaling(int, ostream &);
+int benchAllocScaling(int, ostream &);
+int benchIngest(int, ostream &);
+bool runPerf(const vector<string> &, ostream &);
+
+
+int main(int argc, char *argv[])
+{
+    int argi = 1;
+    if (!loadStorage()) {
+        cerr << "Unknown storage type in " << STORAGE_FILE << endl;
+        return 1;
+    }
+    // Move every site to another storage backend
+    if (argc > argi + 1 && string(argv[argi]).compare("--storage") == 0) {
+        if (!changeStorage(argv[argi + 1])) {
+            cerr << "Unknown storage type, or a site can't be read."
+                 << endl;
+            return 1;
+        }
+        argi += 2;
+    }
 
+    // Serve another site instead of the main one
+    if (argc > argi + 1 && string(argv[argi]).compare("--site") == 0) {
+        currentSite = argv[argi + 1];
+        if (!isValidSite(currentSite)) {
+            cerr << "Invalid site name." << endl;
+            return 1;
+        }
+        registerSite(currentSite);
+        argi += 2;
+    }
+
+    // Fixed seed for picking lots, e.g. to replay the same run again
+    bool isSeedSet = false;
+    if (argc > argi + 1 && string(argv[argi]).compare("--seed") == 0) {
+        setRandomSeed(strtoull(argv[argi + 1], NULL, 10));
+        isSeedSet = true;
+        argi += 2;
+    }
+
+    // Save or restore a snapshot of every site
+    if (argc > argi && (string(argv[argi]).compare("--snapshot") == 0 ||
+                        string(argv[argi]).compare("--restore") == 0)) {
+        string snapFile = argc > argi + 1 ? argv[argi + 1] : SNAPSHOT_FILE;
+        bool isSave = string(argv[argi]).compare("--snapshot") == 0;
+        if (isSave ? saveSnapshot(snapFile) : restoreSnapshot(snapFile))
+            return 0;
+        cerr << "Failed to " << (isSave ? "save " : "restore ")
+             << snapFile << endl;
+        return 1;
+    }
+
+    // Read the audit log
+    if (argc > argi && string(argv[argi]).compare("--audit") == 0) {
+        string auditFile = argc > argi + 1 ? argv[argi + 1] : AUDIT_FILE;
+        ifstream auditRF(auditFile.c_str(), ios::binary);
+        if (!printAudit(auditRF)) {
+            cerr << "Failed to read " << auditFile << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Non-interactive mode for camera events, or a replay of them
+    if (argc > argi && (string(argv[argi]).compare("--ingest") == 0 ||
+                        string(argv[argi]).compare("--replay") == 0)) {
+        bool isReplay = string(argv[argi]).compare("--replay") == 0;
+        if (isReplay && !isSeedSet) setRandomSeed(REPLAY_SEED);
+        if (!isReplay) loadSnapshotCache();
+        if (argc > argi + 1) {
+            ifstream eventFile(argv[argi + 1]);
+            if (!eventFile.good()) {
+                cerr << "Failed to open " << argv[argi + 1] << endl;
+                return 1;
+            }
+            ingestEvents(eventFile, cout, isReplay);
+        } else {
+            ingestEvents(cin, cout, isReplay);
+        }
+        return 0;
+    }
+
+    // Commands without the menus, from the arguments or a file
+    if (argc > argi + 1 && string(argv[argi]).compare("--run") == 0) {
+        vector<string> args(argv + argi + 1, argv + argc);
+        return runCommand(args, cout) ? 0 : 1;
+    }
+    if (argc > argi && string(argv[argi]).compare("--batch") == 0) {
+        loadSnapshotCache();
+        if (argc > argi + 1) {
+            ifstream commandFile(argv[argi + 1]);
+            if (!commandFile.good()) {
+                cerr << "Failed to open " << argv[argi + 1] << endl;
+                return 1;
+            }
+            runBatch(commandFile);
+        } else {
+            runBatch(cin);
+        }
+        return 0;
+    }
 
-int main()
-{
     // Initialize admin for the program
     initAdmin();
     clearScreen();
@@ -56,6 +297,8 @@ int main()
     // Need admin credential to start the system
     cout << "This system need admin previlege to start..\n";
     if (!validateAdmin()) return 0;
+    loadSnapshotCache();
+    alerts.loadSites(loadSites(), currentTime());
 
     while (true) {
         showAtTop();
@@ -101,7 +344,8 @@ void initAdmin() {
     // And write it to a new admin file
     ofstream cAdminFile(ADMIN_FILE.c_str());
     if (cAdminFile.good()) {
-        cAdminFile << username << ' ' << password << '\n';
+        cAdminFile << username << ' '
+                   << hashSecret(password, ADMIN_HASH_ROUNDS) << '\n';
         cout << username << " has been registered as an administrator.\n";
     }
     cAdminFile.close();
@@ -110,6 +354,39 @@ void initAdmin() {
 }
 
 
+// Read the admin credential once & keep it for later checks
+static bool isLoaded = false;
+static string cachedUname, cachedPword;
+
+void loadAdmin(string &corrUname, string &corrPword) {
+    if (!isLoaded) {
+        ifstream rAdminFile(ADMIN_FILE.c_str());
+        if (rAdminFile.good() && rAdminFile >> cachedUname >> cachedPword)
+            isLoaded = true;
+        rAdminFile.close();
+    }
+    corrUname = cachedUname;
+    corrPword = cachedPword;
+}
+
+
+// Replace the stored password (plain text or an older hash) with a
+// fresh hash once the admin has proven to know it
+//==============================================================
+static void upgradeAdmin(string uName, string pWord) {
+    string hashed = hashSecret(pWord, ADMIN_HASH_ROUNDS);
+    string tempName = makeTempName(ADMIN_FILE);
+    ofstream wAdminFile(tempName.c_str());
+    wAdminFile << uName << ' ' << hashed << '\n';
+    wAdminFile.close();
+    if (!wAdminFile.good() || !replaceFile(tempName, ADMIN_FILE)) {
+        remove(tempName.c_str());
+        return;
+    }
+    cachedPword = hashed;
+}
+
+
 bool validateAdmin() {
     string corrUname, corrPword;
     string uName, pWord;
@@ -119,44 +396,320 @@ bool validateAdmin() {
     cout << "Enter Admin Password: ";
     getline(cin, pWord);
 
-    ifstream rAdminFile(ADMIN_FILE.c_str());
-    if (rAdminFile.good())
-        rAdminFile >> corrUname >> corrPword;
-    rAdminFile.close();
+    loadAdmin(corrUname, corrPword);
 
-    if (uName.compare(corrUname) != 0 || pWord.compare(corrPword) != 0) {
+    // Check both so a wrong username takes as long as a wrong password
+    bool isUnameOk = equalsConstTime(uName, corrUname);
+    bool isPwordOk = verifySecret(pWord, corrPword, ADMIN_HASH_ROUNDS);
+    if (corrUname.empty() || !isUnameOk || !isPwordOk) {
+        audit.record(AUDIT_ADMIN_FAIL, currentTime(), currentSite, uName, "");
         cout << "Invalid username or password." << endl;
         pauseScreen();
         return false;
     }
 
+    if (needsRehash(corrPword)) upgradeAdmin(corrUname, pWord);
+    audit.record(AUDIT_ADMIN_OK, currentTime(), currentSite, uName, "");
     return true;
 }
 
 
-double calcTotalSales(double totalCharges) {
-    double totalSales = 0.0;
+Money calcTotalSales(Money totalCharges, string site) {
+    Money totalSales = 0;
+    string text;
+    string salesFile = siteFileName(site, SALES_FILE);
+    // Adding to the sales? Then no other process may in between
+    unique_ptr<FileLock> salesLock;
+    if (totalCharges != 0) salesLock.reset(new FileLock(salesFile));
 
     // Read sales file & get the current sales
-    ifstream rSalesFile(SALES_FILE.c_str());
+    ifstream rSalesFile(salesFile.c_str());
     if (rSalesFile.good()) {
-        rSalesFile >> totalSales;
+        // Older files have the total written as a double
+        if (rSalesFile >> text) parseMoney(text, totalSales);
     } else {
         // If cannot read, create the file
-        ofstream cSalesFile(SALES_FILE.c_str());
-        cSalesFile << totalSales;
+        ofstream cSalesFile(salesFile.c_str());
+        cSalesFile << formatMoney(totalSales);
         cSalesFile.close();
     }
     rSalesFile.close();
 
-    // Increment totalSales and re-write the file
-    ofstream wSalesFile(SALES_FILE.c_str());
+    // Only reading? Then leave the file alone
+    if (totalCharges == 0) return totalSales;
+
+    // Increment totalSales and replace the file in one step
+    string tempFile = makeTempName(salesFile);
+    ofstream wSalesFile(tempFile.c_str());
     if (wSalesFile.good()) {
         totalSales += totalCharges;
-        wSalesFile << totalSales;
+        wSalesFile << formatMoney(totalSales);
     }
     wSalesFile.close();
+    if (!wSalesFile.good() || !replaceFile(tempFile, salesFile))
+        remove(tempFile.c_str());
+
+    return totalSales;
+}
+
+
+// Use the storage backend chosen last time, text files if none
+bool loadStorage() {
+    string storageType = STORAGE_TEXT;
+    ifstream rStorageFile(STORAGE_FILE.c_str());
+    if (rStorageFile.good()) rStorageFile >> storageType;
+    rStorageFile.close();
+    if (!makeStorage(storageType, SITES_FILE)) return false;
+    AutoParkingSystem::setStorageType(storageType);
+    return true;
+}
+
+
+// Copy every site from the current backend to the new one
+bool changeStorage(string storageType) {
+    const string types[2] = { "CAR", "MOTORCYCLE" };
+    for (int i = 0; i < (int)storageType.length(); ++i)
+        storageType[i] = toupper(storageType[i]);
+    if (!makeStorage(storageType, SITES_FILE)) return false;
+
+    vector<string> sites = loadSites();
+    vector<AutoParkingSystem> shards(sites.size() * 2);
+    for (int i = 0; i < (int)sites.size(); ++i) {
+        for (int j = 0; j < 2; ++j) {
+            shards[i * 2 + j].setSite(sites[i]);
+            shards[i * 2 + j].setVehicleType(types[j]);
+            // Nothing is moved unless every site can be read
+            if (!shards[i * 2 + j].readFile()) return false;
+        }
+    }
+    AutoParkingSystem::setStorageType(storageType);
+    for (int i = 0; i < (int)shards.size(); ++i)
+        shards[i].writeAll();
+
+    ofstream wStorageFile(STORAGE_FILE.c_str());
+    wStorageFile << storageType << '\n';
+    wStorageFile.close();
+    return true;
+}
+
+
+// Save every site to one binary file, replacing it atomically
+bool saveSnapshot(string snapFile) {
+    const string types[2] = { "CAR", "MOTORCYCLE" };
+    vector<string> sites = loadSites();
+    string tempFile = makeTempName(snapFile);
+    ofstream snapWF(tempFile.c_str(), ios::binary);
+    if (!snapWF.good()) {
+        remove(tempFile.c_str());
+        return false;
+    }
+
+    snapWF.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    writeBin<uint32_t>(snapWF, SNAPSHOT_VERSION);
+    writeBin<int64_t>(snapWF, currentTime());
+    writeBin<uint32_t>(snapWF, sites.size());
+    for (int i = 0; i < (int)sites.size(); ++i) {
+        writeBinStr(snapWF, sites[i]);
+        writeBin<int64_t>(snapWF, calcTotalSales(0, sites[i]));
+        for (int j = 0; j < 2; ++j) {
+            AutoParkingSystem siteVeh;
+            siteVeh.setSite(sites[i]);
+            siteVeh.setVehicleType(types[j]);
+            // A snapshot missing a site would restore it empty
+            if (!siteVeh.readFile()) {
+                snapWF.close();
+                remove(tempFile.c_str());
+                return false;
+            }
+            siteVeh.writeSnapshot(snapWF);
+        }
+    }
+    // Finished stays go last, so a start can stop before them
+    for (int i = 0; i < (int)sites.size(); ++i) {
+        for (int j = 0; j < 2; ++j) {
+            AutoParkingSystem siteVeh;
+            siteVeh.setSite(sites[i]);
+            siteVeh.setVehicleType(types[j]);
+            siteVeh.writeHistory(snapWF);
+        }
+    }
+    snapWF.close();
+    if (!snapWF.good() || !replaceFile(tempFile, snapFile)) {
+        remove(tempFile.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// Load a whole snapshot with one read & check every site: its name,
+// sales & car & motorcycle shards (2 per site), & the finished stays
+// of the shards if asked for. No file is changed
+bool readSnapshotFile(string snapFile, vector<string> &sites,
+                      vector<Money> &sales,
+                      vector<AutoParkingSystem> &shards, int64_t &takenAt,
+                      bool withHistory) {
+    const string types[2] = { "CAR", "MOTORCYCLE" };
+    ifstream snapRF(snapFile.c_str(), ios::binary | ios::ate);
+    if (!snapRF.good()) return false;
+    string data((size_t)snapRF.tellg(), '\0');
+    snapRF.seekg(0, snapRF.beg);
+    if (!data.empty() && !snapRF.read(&data[0], data.size())) return false;
+    snapRF.close();
+
+    istringstream in(data);
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    uint32_t version, totalSites;
+    if (!in.read(magic, sizeof(magic)) ||
+        !equal(magic, magic + sizeof(magic), SNAPSHOT_MAGIC) ||
+        !readBin(in, version) || version < 1 || version > SNAPSHOT_VERSION ||
+        !readBin(in, takenAt) || !readBin(in, totalSites))
+        return false;
+    // A corrupt count can't ask for more sites than the bytes left hold
+    if (totalSites > (data.size() - (size_t)in.tellg()) / MIN_SNAPSHOT_SITE)
+        return false;
+
+    sites.assign(totalSites, "");
+    sales.assign(totalSites, 0);
+    vector<AutoParkingSystem>(totalSites * 2).swap(shards);
+    double oldSales;
+    for (u32 i = 0; i < totalSites; ++i) {
+        if (!readBinStr(in, sites[i]) || !isValidSite(sites[i]))
+            return false;
+        // Version 1 kept the sales as a double
+        if (version == 1 && readBin(in, oldSales))
+            parseMoney(to_string(oldSales), sales[i]);
+        else if (version == 1 || !readBin(in, sales[i]))
+            return false;
+        for (int j = 0; j < 2; ++j) {
+            shards[i * 2 + j].setSite(sites[i]);
+            shards[i * 2 + j].setVehicleType(types[j]);
+            if (!shards[i * 2 + j].readSnapshot(in, version)) return false;
+        }
+    }
+    // Older snapshots have no history, theirs is left as it is
+    if (!withHistory || version < 3) return true;
+    for (u32 i = 0; i < totalSites * 2; ++i)
+        if (!shards[i].readHistory(in)) return false;
+    return true;
+}
+
+
+// Check every site of the snapshot, then rewrite their files
+bool restoreSnapshot(string snapFile) {
+    vector<string> sites;
+    vector<Money> sales;
+    vector<AutoParkingSystem> shards;
+    int64_t takenAt;
+    if (!readSnapshotFile(snapFile, sites, sales, shards, takenAt, true))
+        return false;
+
+    // Every site checked, now put them back
+    u32 totalSites = sites.size();
+    for (u32 i = 0; i < totalSites; ++i) {
+        registerSite(sites[i]);
+        shards[i * 2].writeAll();
+        shards[i * 2 + 1].writeAll();
+        string salesFile = siteFileName(sites[i], SALES_FILE);
+        string tempFile = makeTempName(salesFile);
+        ofstream wSalesFile(tempFile.c_str());
+        wSalesFile << formatMoney(sales[i]);
+        wSalesFile.close();
+        if (!wSalesFile.good() || !replaceFile(tempFile, salesFile))
+            remove(tempFile.c_str());
+    }
+    time_t snapTime = takenAt;
+    cout << "Restored " << totalSites << " site(s) as of "
+         << put_time(localtime(&snapTime), DTFORMAT) << endl;
+    return true;
+}
 
+
+// Start from the last snapshot: sites whose files are as the snapshot
+// found them are not parsed again (e.g. by the alerts at start)
+void loadSnapshotCache() {
+    vector<string> sites;
+    vector<Money> sales;
+    vector<AutoParkingSystem> shards;
+    int64_t takenAt;
+    if (readSnapshotFile(SNAPSHOT_FILE, sites, sales, shards, takenAt, false))
+        AutoParkingSystem::cacheSnapshot(shards);
+}
+
+
+void autoSnapshot() {
+    static time_t lastSnapshot = 0;
+    if (currentTime() - lastSnapshot < SNAPSHOT_PERIOD) return;
+    if (saveSnapshot(SNAPSHOT_FILE))
+        lastSnapshot = currentTime();
+}
+
+
+// Main site first, then every site listed in the sites file
+vector<string> loadSites() {
+    vector<string> sites(1, "");
+    string site;
+    ifstream rSitesFile(SITES_FILE.c_str());
+    while (rSitesFile >> site)
+        if (isValidSite(site))
+            sites.push_back(site);
+    rSitesFile.close();
+    return sites;
+}
+
+
+void registerSite(string site) {
+    if (site.empty()) return;
+    vector<string> sites = loadSites();
+    if (find(sites.begin(), sites.end(), site) != sites.end()) return;
+    ofstream wSitesFile(SITES_FILE.c_str(), ios::app);
+    if (wSitesFile.good())
+        wSitesFile << site << '\n';
+    wSitesFile.close();
+}
+
+
+// Look for the plate in every site & vehicle type at once
+void findPlateAllSites(string plateNo) {
+    const string types[2] = { "CAR", "MOTORCYCLE" };
+    vector<string> sites = loadSites();
+    vector<future<string> > results;
+    for (int i = 0; i < (int)sites.size(); ++i) {
+        for (int j = 0; j < 2; ++j) {
+            results.push_back(async(launch::async,
+                [](string site, string type, string plate) {
+                    AutoParkingSystem siteVeh;
+                    siteVeh.setSite(site);
+                    siteVeh.setVehicleType(type);
+                    siteVeh.readFile();
+                    return siteVeh.getLotByPlateNo(plate);
+                }, sites[i], types[j], plateNo));
+        }
+    }
+
+    bool isFound = false;
+    for (int i = 0; i < (int)results.size(); ++i) {
+        string lotNo = results[i].get();
+        if (lotNo.compare("N/A") == 0) continue;
+        string site = sites[i / 2];
+        cout << plateNo << " located at "
+             << (site.empty() ? "main site" : "site " + site)
+             << ", " << types[i % 2] << " lot no " << lotNo << ".\n";
+        isFound = true;
+    }
+    if (!isFound) cout << plateNo << " is not available at any site.\n";
+}
+
+
+Money calcTotalSalesAllSites() {
+    vector<string> sites = loadSites();
+    vector<future<Money> > results;
+    for (int i = 0; i < (int)sites.size(); ++i)
+        results.push_back(async(launch::async, calcTotalSales,
+                                (Money)0, sites[i]));
+    Money totalSales = 0;
+    for (int i = 0; i < (int)results.size(); ++i)
+        totalSales += results[i].get();
     return totalSales;
 }
 
@@ -169,11 +722,14 @@ void userMenu() {
         cout << "USER MENU\n"
              << "1. Park/Unpark Car\n"
              << "2. Park/Unpark Motorcycle\n"
-             << "3. Back to main menu\n"
-             << "Select option (1-3): ";
-        opt = inputOption(1, 3);
-        if (opt == 3) return;
-        userFeatures(opt);
+             << "3. Reserve Car Lot\n"
+             << "4. Reserve Motorcycle Lot\n"
+             << "5. Back to main menu\n"
+             << "Select option (1-5): ";
+        opt = inputOption(1, 5);
+        if (opt == 5) return;
+        if (opt == 3 || opt == 4) userReserve(opt - 2);
+        else userFeatures(opt);
     }
 }
 
@@ -190,19 +746,32 @@ void userFeatures(int opt) {
 
     userVeh.setPlateNo(plateNo);
     userVeh.setPinNo(pinNo);
+    userVeh.setSite(currentSite);
     switch (opt) {
         case 1: userVeh.setVehicleType("CAR"); break;
         case 2: userVeh.setVehicleType("MOTORCYCLE"); break;
     }
 
-    userVeh.readFile();
-    
     if (!userVeh.validateInput()) {
+        cout << userVeh.getInputError();
         pauseScreen();
         return;
     }
 
-    userVeh.writeFile();
+    // Other processes' gates wait until this one is written
+    userVeh.lockFiles();
+    userVeh.readFile();
+    ApsStatus result = userVeh.writeFile();
+    userVeh.unlockFiles();
+    if (result == APS_INVALID_PIN)
+        cout << "Sorry, invalid pin no!" << endl;
+    else if (result == APS_FULL)
+        cout << "Sorry, no more parking lot. All full!" << endl;
+    else if (result == APS_STORAGE_ERROR) {
+        cout << "Sorry, the parking records can't be read or saved!" << endl;
+        pauseScreen();
+        return;
+    }
 
     // Get the formatted data
     MyVehicle veh;
@@ -210,6 +779,7 @@ void userFeatures(int opt) {
     veh.pinNo       = userVeh.getPinNo();
     veh.lotNo       = userVeh.getLotNo();
     veh.vehicleType = userVeh.getVehicleType();
+    veh.bookingMoved = userVeh.isBookingMoved();
 
     // Show receipt only for unpark the car & correct pin
     if (!userVeh.isNewPlateNo()) {
@@ -219,10 +789,15 @@ void userFeatures(int opt) {
             veh.duration    = userVeh.getDuration();
             veh.charges     = userVeh.getCharges();
             showReceipt(veh);
-            double tSales = calcTotalSales(veh.charges);
+            alerts.onUnpark(currentSite, veh.vehicleType, veh.plateNo);
+            calcTotalSales(veh.charges, currentSite);
             cout << "\n\tThanks for using IBAPS\n";
         }
-    } else {
+    } else if (veh.lotNo.compare("N/A") != 0) {
+        alerts.onPark(currentSite, veh.vehicleType, veh.plateNo, veh.lotNo,
+                      userVeh.getDateTimeIn());
+        if (veh.bookingMoved)
+            cout << "Sorry, your booked lot is still taken.\n";
         cout << "Your vehicle, " << veh.plateNo
              << " will be moved to the empty parking lot.\n"
              << "Please remember your PIN number."
@@ -233,11 +808,64 @@ void userFeatures(int opt) {
 }
 
 
+void userReserve(int opt) {
+    string plateNo, dateTimeIn;
+    int hours;
+    struct tm tmIn = {};
+    AutoParkingSystem userVeh;
+
+    // Get inputs & validate it
+    cout << "\nEnter vehicle plate no: ";
+    getline(cin, plateNo);
+    cout << "Enter date/time in (dd-mm-yyyy hh:mm): ";
+    getline(cin, dateTimeIn);
+    cout << "Enter number of hours (1-72): ";
+    hours = inputOption(1, 72);
+
+    istringstream ss(dateTimeIn);
+    ss >> get_time(&tmIn, RESVFORMAT);
+    if (ss.fail()) {
+        cout << "Invalid date/time." << endl;
+        pauseScreen();
+        return;
+    }
+    tmIn.tm_isdst = -1;
+    time_t from = mktime(&tmIn);
+    time_t to = from + hours * 3600;
+
+    userVeh.setPlateNo(plateNo);
+    userVeh.setSite(currentSite);
+    switch (opt) {
+        case 1: userVeh.setVehicleType("CAR"); break;
+        case 2: userVeh.setVehicleType("MOTORCYCLE"); break;
+    }
+    userVeh.lockFiles();
+    bool isRead = userVeh.readFile();
+    bool isReserved = isRead && userVeh.reserveLot(from, to);
+    userVeh.unlockFiles();
+
+    if (!isRead) {
+        cout << "Sorry, the parking records can't be read!" << endl;
+    } else if (isReserved) {
+        alerts.onReserve(currentSite, userVeh.getVehicleType(),
+                         userVeh.getPlateNo(), userVeh.getLotNo(), from, to);
+        cout << "Lot no " << userVeh.getLotNo() << " is reserved for "
+             << userVeh.getPlateNo() << " from "
+             << put_time(localtime(&from), DTFORMAT) << " to "
+             << put_time(localtime(&to), DTFORMAT) << ".\n";
+    } else {
+        cout << "Sorry, no lot is free for that time." << endl;
+    }
+
+    pauseScreen();
+}
+
+
 void adminMenu() {
     // Only admin can pass
     if (!validateAdmin()) return;
 
-    double tSales;
+    Money tSales;
     int opt1, opt2;
     while (true) {
         showAtTop();
@@ -246,14 +874,17 @@ void adminMenu() {
              << "1. See car data\n"
              << "2. See motorcycle data\n"
              << "3. View total sales\n"
-             << "4. Back to main menu\n"
-             << "5. Exit/Shutdown the system (BE CAREFUL)\n"
-             << "Select option (1-5): ";
-        opt1 = inputOption(1, 5);
-        if (opt1 == 4) return;
+             << "4. View reports\n"
+             << "5. Find plate no in all sites\n"
+             << "6. View total sales of all sites\n"
+             << "7. Back to main menu\n"
+             << "8. Exit/Shutdown the system (BE CAREFUL)\n"
+             << "Select option (1-8): ";
+        opt1 = inputOption(1, 8);
+        if (opt1 == 7) return;
 
         // Exit the program
-        if (opt1 == 5) {
+        if (opt1 == 8) {
             cout << "\nPlease confirm that you really want to exit the\n"
                  << "system by inserting admin username and password.\n";
             if (validateAdmin()) exit(0);
@@ -262,8 +893,34 @@ void adminMenu() {
         
         // Show total sales
         if (opt1 == 3) {
-            tSales = calcTotalSales(0.0);
-            cout << "\nTotal Sales: RM " << tSales << endl;
+            tSales = calcTotalSales(0, currentSite);
+            cout << "\nTotal Sales: RM " << formatMoney(tSales) << endl;
+            pauseScreen();
+            continue;
+        }
+
+        // Show reports
+        if (opt1 == 4) {
+            showReports();
+            pauseScreen();
+            continue;
+        }
+
+        // Search every site
+        if (opt1 == 5) {
+            string searchPN;
+            cout << "\nEnter plate no that you want to search: ";
+            getline(cin, searchPN);
+            findPlateAllSites(searchPN);
+            pauseScreen();
+            continue;
+        }
+
+        // Show total sales of every site
+        if (opt1 == 6) {
+            tSales = calcTotalSalesAllSites();
+            cout << "\nTotal Sales (all sites): RM " << formatMoney(tSales)
+                 << endl;
             pauseScreen();
             continue;
         }
@@ -296,6 +953,7 @@ void adminFeatures(int vehicle, int opt) {
 
     showAtTop();
     AutoParkingSystem adminVeh;
+    adminVeh.setSite(currentSite);
 
     // Set the type of vehicle first
     switch (vehicle) {
@@ -307,12 +965,15 @@ void adminFeatures(int vehicle, int opt) {
                 break;
     }
 
-    adminVeh.readFile();
+    if (!adminVeh.readFile())
+        cout << "The parking records can't be read!" << endl;
 
     // Get total number of vehicle in the file
     totalLines = adminVeh.getTotalLines();
 
     // Sort first before get the sorted data
+    if (totalLines == 0 && opt >= 2 && opt <= 4)
+        cout << "No data in the file" << endl;
     switch (opt) {
         case 2: adminVeh.sortByPlateNo(); break;
         case 3: adminVeh.sortByLotNo(); break;
@@ -373,27 +1034,33 @@ int inputOption(int min, int max) {
 
 void showAtTop() {
     clearScreen();
+    alerts.advance(currentTime());
+    autoSnapshot();
     u32 totalCars, totalMoto;
 
     AutoParkingSystem car;
+    car.setSite(currentSite);
     car.setVehicleType("CAR");
     car.readFile();
     totalCars = car.getTotalLines();
 
     AutoParkingSystem moto;
+    moto.setSite(currentSite);
     moto.setVehicleType("MOTORCYCLE");
     moto.readFile();
     totalMoto = moto.getTotalLines();
 
     cout << "\tWELCOME TO IBN-BAJJAH AUTO PARKING SYSTEM\n"
-         << string(57, '=') << "\n\n"
-         << "Car: " << 100 - totalCars << "/100 parking left\n"
+         << string(57, '=') << "\n\n";
+    if (!currentSite.empty())
+        cout << "Site: " << currentSite << "\n";
+    cout << "Car: " << 100 - totalCars << "/100 parking left\n"
          << "Motorcycle: " << 100 - totalMoto << "/100 parking left\n\n";
 }
 
 
 void showReceipt(MyVehicle currVeh) {
-    long int sec = (int)currVeh.duration;
+    long int sec = (long int)currVeh.duration;
     int min = sec / 60;
     int hr = min / 60;
 
@@ -424,7 +1091,7 @@ void showReceipt(MyVehicle currVeh) {
              << sec % 60 << "s"
              << endl;
         cout << setw(15) << left << "Total Charges" << ": RM"
-             << setprecision(2) << fixed << currVeh.charges
+             << formatMoney(currVeh.charges)
              << endl;
     } else {
         cout << setw(15) << left << "Date/Time out" << ": N/A" << endl;
@@ -488,6 +1155,925 @@ void showAllDetails(string veh, string *ptrLN, string *ptrPN,
 }
 
 
+// Read events in batches & apply each site's events in parallel
+// A replay runs the events against empty scratch sites, on the
+// time of the events & a fixed seed, with no alerts, snapshots or
+// audit records. It ends with the sales of each site, how long it took
+// & a digest of every receipt, the same for every run of the events.
+// Events without a site are for the site being served (--site)
+void ingestEvents(istream &in, ostream &out, bool isReplay) {
+    string line, site, field;
+    vector<string> lines, receipts;
+    map<string, vector<int> > batch;
+    map<string, map<string, time_t> > lastSeen;
+    vector<string> sites = loadSites();
+    set<string> knownSites(sites.begin(), sites.end());
+    map<string, int> siteShards;
+    TaskPool pool;
+    int batchSize, totalEvents = 0;
+    time_t eventTime, latestTime = 0;
+    bool isEof = false;
+    uint64_t digest = 0xcbf29ce484222325ULL;
+    shared_ptr<ManualClock> replayClock;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (isReplay) {
+        replayClock.reset(new ManualClock(0));
+        setClock(replayClock);
+        audit.setEnabled(false);
+        knownSites.clear();
+    }
+
+    while (!isEof) {
+        // Group the next batch of events by site, keeping their order
+        batch.clear();
+        lines.clear();
+        for (batchSize = 0; batchSize < INGEST_BATCH; ++batchSize) {
+            if (!getline(in, line)) {
+                isEof = true;
+                break;
+            }
+            istringstream ss(line);
+            site = currentSite;
+            if (ss >> eventTime && eventTime > latestTime) {
+                // Alerts start from the time of the first event
+                if (latestTime == 0 && !isReplay)
+                    alerts.loadSites(sites, eventTime);
+                latestTime = eventTime;
+            }
+            for (int i = 1; i < 6 && ss >> field; ++i)
+                if (i == 5) site = field;
+            if (isValidSite(site) && knownSites.insert(site).second &&
+                !isReplay)
+                registerSite(site);
+            batch[site].push_back(lines.size());
+            lines.push_back(line);
+            ++totalEvents;
+        }
+
+        // One task per site, each site owns its files & dedup window,
+        // & a site keeps its worker from batch to batch. A receipt goes
+        // in the slot of its event
+        if (isReplay) replayClock->set(latestTime);
+        receipts.assign(lines.size(), "");
+        map<string, vector<int> >::iterator it;
+        for (it = batch.begin(); it != batch.end(); ++it) {
+            if (siteShards.find(it->first) == siteShards.end()) {
+                int shard = siteShards.size();
+                siteShards[it->first] = shard;
+            }
+            pool.submit(siteShards[it->first],
+                        bind(ingestSiteEvents, it->first, &lines,
+                             &it->second, &lastSeen[it->first], &receipts,
+                             isReplay));
+        }
+        pool.wait();
+
+        // Receipts in the order the events came in
+        for (int i = 0; i < (int)receipts.size(); ++i) {
+            const string &text = receipts[i];
+            out << text;
+            // FNV-1a of every receipt in order
+            for (string::size_type j = 0; j < text.length(); ++j) {
+                digest ^= (unsigned char)text[j];
+                digest *= 0x100000001b3ULL;
+            }
+        }
+        out.flush();
+        if (isReplay) continue;
+        if (latestTime != 0) alerts.advance(latestTime);
+        autoSnapshot();
+    }
+    if (!isReplay) return;
+
+    chrono::duration<double> taken = chrono::steady_clock::now() - start;
+    ostringstream hexDigest;
+    hexDigest << hex << setw(16) << setfill('0') << digest;
+    out << "{\"replay\":\"done\",\"events\":" << totalEvents
+         << ",\"seed\":" << getRandomSeed()
+         << ",\"seconds\":" << fixed << setprecision(3) << taken.count()
+         << ",\"digest\":" << jsonString(hexDigest.str())
+         << ",\"sales\":{";
+    set<string>::iterator siteIt;
+    for (siteIt = knownSites.begin(); siteIt != knownSites.end(); ++siteIt) {
+        out << (siteIt == knownSites.begin() ? "" : ",")
+             << jsonString(*siteIt) << ':'
+             << formatMoney(calcTotalSales(0, replaySite(*siteIt)));
+    }
+    out << "}}" << endl;
+    clearScratchSites();
+    setClock(shared_ptr<Clock>(new SystemClock));
+    audit.setEnabled(true);
+}
+
+
+// Scratch site a site is replayed in, its real files are never touched
+string replaySite(string site) {
+    return makeScratchSite(REPLAY_PREFIX + site);
+}
+
+
+// Events of one site of a batch, at the given lines
+void ingestSiteEvents(string site, const vector<string> *lines,
+                      const vector<int> *indices,
+                      map<string, time_t> *lastSeen,
+                      vector<string> *receipts, bool isReplay) {
+    for (int i = 0; i < (int)indices->size(); ++i) {
+        int index = (*indices)[i];
+        ostringstream receipt;
+        ingestEvent(site, (*lines)[index], lastSeen, receipt, isReplay);
+        (*receipts)[index] = receipt.str();
+    }
+}
+
+
+void ingestEvent(string site, const string &line,
+                 map<string, time_t> *lastSeen, ostream &out,
+                 bool isReplay) {
+    string action, vehType;
+    time_t eventTime;
+    MyVehicle veh;
+    veh.plateNo = veh.pinNo = veh.lotNo = veh.vehicleType = "N/A";
+    veh.bookingMoved = false;
+    istringstream ss(line);
+    if (!(ss >> eventTime >> action >> vehType >> veh.plateNo >> veh.pinNo)) {
+        if (line.find_first_not_of(" \t\r") != string::npos)
+            printEventReceipt(out, 0, "N/A", "BAD_EVENT", "", veh);
+        return;
+    }
+
+    AutoParkingSystem camVeh;
+    camVeh.setPlateNo(veh.plateNo);
+    camVeh.setPinNo(veh.pinNo);
+    camVeh.setVehicleType(vehType);
+    camVeh.setSite(isReplay && isValidSite(site) ? replaySite(site)
+                                                 : site);
+    camVeh.setDateTime(eventTime);
+    veh.plateNo     = camVeh.getPlateNo();
+    veh.pinNo       = camVeh.getPinNo();
+    veh.lotNo       = "N/A";
+    veh.vehicleType = camVeh.getVehicleType();
+    veh.duration    = 0;
+    veh.charges     = 0;
+
+    // Same plate read again by the same camera within the window
+    string key = action + ' ' + veh.vehicleType + ' ' + veh.plateNo;
+    map<string, time_t>::iterator seen = lastSeen->find(key);
+    if (seen != lastSeen->end() && eventTime >= seen->second &&
+        eventTime - seen->second < DEDUP_WINDOW) {
+        printEventReceipt(out, eventTime, action, "DUPLICATE", site, veh);
+        return;
+    }
+
+    if (action.compare("PARK") != 0 && action.compare("UNPARK") != 0) {
+        printEventReceipt(out, eventTime, action, "BAD_EVENT", site, veh);
+        return;
+    }
+
+    // Park or unpark only, nothing is printed by the class
+    bool isPark = action.compare("PARK") == 0;
+    ApsStatus result = isPark ? camVeh.park() : camVeh.unpark();
+    string status = statusName(result);
+
+    if (result == APS_OK) {
+        (*lastSeen)[key] = eventTime;
+        // Plate that was unparked if the camera misread it
+        veh.plateNo = camVeh.getPlateNo();
+        veh.lotNo = camVeh.getLotNo();
+        veh.bookingMoved = camVeh.isBookingMoved();
+        if (isPark && !isReplay)
+            alerts.onPark(site, veh.vehicleType, veh.plateNo, veh.lotNo,
+                          eventTime);
+        else if (!isReplay)
+            alerts.onUnpark(site, veh.vehicleType, veh.plateNo);
+        if (!isPark) {
+            veh.dateTimeIn  = camVeh.getDateTimeIn();
+            veh.dateTimeOut = camVeh.getDateTimeOut();
+            veh.duration    = camVeh.getDuration();
+            veh.charges     = camVeh.getCharges();
+            calcTotalSales(veh.charges, camVeh.getSite());
+        }
+    }
+    printEventReceipt(out, eventTime, action, status, site, veh);
+}
+
+
+void printEventReceipt(ostream &out, time_t eventTime, string action,
+                       string status, string site, MyVehicle currVeh) {
+    out << "{\"time\":" << eventTime
+        << ",\"event\":" << jsonString(action)
+        << ",\"status\":" << jsonString(status)
+        << ",\"site\":" << jsonString(site)
+        << ",\"type\":" << jsonString(currVeh.vehicleType)
+        << ",\"plate\":" << jsonString(currVeh.plateNo)
+        << ",\"lot\":" << jsonString(currVeh.lotNo);
+    if (currVeh.bookingMoved)
+        out << ",\"booking_moved\":true";
+    if (status.compare("OK") == 0 && action.compare("UNPARK") == 0)
+        out << ",\"in\":" << currVeh.dateTimeIn
+            << ",\"out\":" << currVeh.dateTimeOut
+            << ",\"duration\":" << currVeh.duration
+            << ",\"charges\":" << formatMoney(currVeh.charges);
+    out << "}\n";
+}
+
+
+void runBatch(istream &in) {
+    string line, word;
+    alerts.loadSites(loadSites(), currentTime());
+    while (getline(in, line)) {
+        istringstream ss(line);
+        vector<string> args;
+        while (ss >> word) args.push_back(word);
+        if (!args.empty() && args[0][0] != '#') runCommand(args, cout);
+    }
+    alerts.advance(currentTime());
+    cout.flush();
+}
+
+
+// Run one command, true if it succeeded
+bool runCommand(const vector<string> &args, ostream &out) {
+    string command = args.empty() ? "" : args[0];
+    if ((command.compare("park") == 0 && args.size() >= 4 &&
+         args.size() <= 5) ||
+        (command.compare("unpark") == 0 && args.size() == 4))
+        return runGate(command.compare("park") == 0, args, out);
+    if (command.compare("lookup") == 0 && args.size() == 2)
+        return runLookup(args[1], out);
+    if (command.compare("bench") == 0 && args.size() <= 2)
+        return runBench(args, out);
+    if (command.compare("perf") == 0 && args.size() <= 4)
+        return runPerf(args, out);
+    if (command.compare("list") == 0 && args.size() == 2)
+        runList(args[1], out);
+    else if (command.compare("stats") == 0 && args.size() == 1)
+        runStats(out);
+    else {
+        out << "{\"command\":" << jsonString(command)
+            << ",\"status\":\"BAD_COMMAND\"}\n";
+        return false;
+    }
+    return true;
+}
+
+
+// park/unpark <type> <plateNo> <pinNo> [bay type], printed like an
+// ingest receipt
+bool runGate(bool isPark, const vector<string> &args, ostream &out) {
+    time_t now = currentTime();
+    AutoParkingSystem gateVeh;
+    gateVeh.setVehicleType(args[1]);
+    gateVeh.setPlateNo(args[2]);
+    gateVeh.setPinNo(args[3]);
+    if (args.size() > 4) gateVeh.setBayType(args[4]);
+    gateVeh.setSite(currentSite);
+    gateVeh.setDateTime(now);
+    ApsStatus result = isPark ? gateVeh.park() : gateVeh.unpark();
+
+    MyVehicle veh;
+    veh.plateNo     = gateVeh.getPlateNo();
+    veh.pinNo       = gateVeh.getPinNo();
+    veh.vehicleType = gateVeh.getVehicleType();
+    veh.lotNo       = result == APS_OK ? gateVeh.getLotNo() : "N/A";
+    veh.bookingMoved = gateVeh.isBookingMoved();
+    if (result == APS_OK && isPark) {
+        alerts.onPark(currentSite, veh.vehicleType, veh.plateNo, veh.lotNo,
+                      now);
+    } else if (result == APS_OK) {
+        veh.dateTimeIn  = gateVeh.getDateTimeIn();
+        veh.dateTimeOut = gateVeh.getDateTimeOut();
+        veh.duration    = gateVeh.getDuration();
+        veh.charges     = gateVeh.getCharges();
+        alerts.onUnpark(currentSite, veh.vehicleType, veh.plateNo);
+        calcTotalSales(veh.charges, currentSite);
+    }
+    printEventReceipt(out, now, isPark ? "PARK" : "UNPARK",
+                      statusName(result), currentSite, veh);
+    return result == APS_OK;
+}
+
+
+// Lot of a plate, whichever vehicle type it is, else the parked plates
+// it may be a misread of & false
+bool runLookup(string plateNo, ostream &out) {
+    const string types[2] = { "CAR", "MOTORCYCLE" };
+    vector<string> similar;
+    for (int i = 0; i < 2; ++i) {
+        AutoParkingSystem siteVeh;
+        siteVeh.setSite(currentSite);
+        siteVeh.setVehicleType(types[i]);
+        siteVeh.setPlateNo(plateNo);
+        if (!siteVeh.readFile()) {
+            out << "{\"command\":\"lookup\",\"status\":\"STORAGE_ERROR\""
+                << ",\"site\":" << jsonString(currentSite)
+                << ",\"type\":" << jsonString(types[i]) << "}\n";
+            return false;
+        }
+        string lotNo = siteVeh.getLotByPlateNo(siteVeh.getPlateNo());
+        if (lotNo.compare("N/A") != 0) {
+            out << "{\"command\":\"lookup\",\"status\":\"OK\""
+                << ",\"site\":" << jsonString(currentSite)
+                << ",\"type\":" << jsonString(types[i])
+                << ",\"plate\":" << jsonString(siteVeh.getPlateNo())
+                << ",\"lot\":" << jsonString(lotNo) << "}\n";
+            return true;
+        }
+        vector<string> close = siteVeh.findSimilarPlates(plateNo);
+        similar.insert(similar.end(), close.begin(), close.end());
+    }
+    out << "{\"command\":\"lookup\",\"status\":\"NOT_PARKED\""
+        << ",\"site\":" << jsonString(currentSite)
+        << ",\"similar\":[";
+    for (int i = 0; i < (int)similar.size(); ++i)
+        out << (i ? "," : "") << jsonString(similar[i]);
+    out << "]}\n";
+    return false;
+}
+
+
+// Every parked vehicle of a type, by lot no
+void runList(string vehicleType, ostream &out) {
+    vector<Stay> stays;
+    AutoParkingSystem siteVeh;
+    siteVeh.setSite(currentSite);
+    siteVeh.setVehicleType(vehicleType);
+    bool isRead = siteVeh.readFile();
+    siteVeh.sortByLotNo();
+    siteVeh.getParkedStays(stays);
+
+    out << "{\"command\":\"list\",\"status\":"
+        << (isRead ? "\"OK\"" : "\"STORAGE_ERROR\"")
+        << ",\"site\":" << jsonString(currentSite)
+        << ",\"type\":" << jsonString(siteVeh.getVehicleType())
+        << ",\"vehicles\":[";
+    for (int i = 0; i < (int)stays.size(); ++i)
+        out << (i ? "," : "")
+            << "{\"lot\":" << jsonString(stays[i].lot_no)
+            << ",\"plate\":" << jsonString(stays[i].plate_no)
+            << ",\"in\":" << stays[i].date_time_in << '}';
+    out << "]}\n";
+}
+
+
+// Parked & free lots of each type, bays taken of each bay type (all
+// standard when the bay layout is rejected) and the total sales of
+// the site
+void runStats(ostream &out) {
+    AutoParkingSystem car, moto;
+    BayAllocator carBays, motoBays;
+    car.setSite(currentSite);
+    car.setVehicleType("CAR");
+    bool isRead = car.readFile();
+    bool isLayoutOk = car.loadBays(carBays);
+    moto.setSite(currentSite);
+    moto.setVehicleType("MOTORCYCLE");
+    isRead = moto.readFile() && isRead;
+    isLayoutOk = moto.loadBays(motoBays) && isLayoutOk;
+    bool isRatesOk;
+    getPricing(isRatesOk);
+
+    out << "{\"command\":\"stats\",\"status\":"
+        << (isRead ? "\"OK\"" : "\"STORAGE_ERROR\"")
+        << ",\"site\":" << jsonString(currentSite)
+        << ",\"bay_layout\":" << (isLayoutOk ? "\"OK\"" : "\"INVALID\"")
+        << ",\"rates\":" << (isRatesOk ? "\"OK\"" : "\"INVALID\"")
+        << ",\"car_parked\":" << car.getTotalLines()
+        << ",\"car_free\":" << TOTAL_ALL_LOT - car.getTotalLines()
+        << ",\"moto_parked\":" << moto.getTotalLines()
+        << ",\"moto_free\":" << TOTAL_ALL_LOT - moto.getTotalLines()
+        << ",\"car_bays\":";
+    printBays(out, carBays);
+    out << ",\"moto_bays\":";
+    printBays(out, motoBays);
+    out
+        << ",\"total_sales\":"
+        << formatMoney(calcTotalSales(0, currentSite)) << "}\n";
+}
+
+
+// {"STANDARD":{"used":n,"total":n},...}
+void printBays(ostream &out, BayAllocator &bays) {
+    out << '{';
+    for (int type = 0; type < TOTAL_BAY_TYPE; ++type)
+        out << (type ? "," : "") << jsonString(bayTypeName(type))
+            << ":{\"used\":" << bays.getUsed(type)
+            << ",\"total\":" << bays.getTotal(type) << '}';
+    out << '}';
+}
+
+
+// Vehicles of a bay mix allocated on one floor only, the oldest bay
+// freed once the floor is 90% full, a floor task of the bench
+void churnFloor(BayAllocator *bays, int floor, int vehicles,
+                const int *mix, int *allocated) {
+    Random rng(getRandomSeed());
+    deque<int> taken;
+    int lot;
+    *allocated = 0;
+    for (int i = 0; i < vehicles; ++i) {
+        if (bays->allocateOnFloor(mix[i % TOTAL_LOT_PER_FLOOR], floor, lot,
+                                  rng)) {
+            taken.push_back(lot);
+            ++*allocated;
+        }
+        if ((int)taken.size() >= TOTAL_LOT_PER_FLOOR * 9 / 10) {
+            bays->release(floor, taken.front());
+            taken.pop_front();
+        }
+    }
+}
+
+
+// bench [count]: each part of the bench adds its numbers to the reply
+// & returns how many of its operations failed. The count is of gate
+// operations, the other parts do a multiple of it (capped by
+// BENCH_MAX_PLATES & BENCH_MAX_STAYS). Scratch sites, not audited
+bool runBench(const vector<string> &args, ostream &out) {
+    int total = 1000;
+    if (args.size() == 2) {
+        const string &count = args[1];
+        bool isNumber = !count.empty() && count.length() <= 7;
+        for (int i = 0; i < (int)count.length() && isNumber; ++i)
+            isNumber = isdigit((unsigned char)count[i]) != 0;
+        total = isNumber ? atoi(count.c_str()) : 0;
+    }
+    if (total < 1 || total > BENCH_MAX_TOTAL) {
+        out << "{\"command\":\"bench\",\"status\":\"BAD_COMMAND\"}\n";
+        return false;
+    }
+
+    const string site = makeScratchSite("bench");
+    audit.setEnabled(false);
+    ostringstream results;
+    results << fixed << setprecision(2);
+    int failed = benchGates(site, total, results) +
+                 benchAllocator(total, results) +
+                 benchBilling(total, results) +
+                 benchFuzzy(site, total, results) +
+                 benchScaling(total, results) +
+                 benchAllocScaling(total, results) +
+                 benchIngest(total, results);
+    out << "{\"command\":\"bench\",\"status\":\""
+        << (failed ? "FAILED" : "OK") << '"'
+        << ",\"failed\":" << failed << results.str() << "}\n";
+    clearScratchSites();
+    audit.setEnabled(true);
+    return failed == 0;
+}
+
+
+// A full garage of the bay mix parked then unparked through the
+// library until done
+int benchGates(string site, int total, ostream &out) {
+    string baysFile = siteFileName(site, BAYS_FILE);
+    ofstream baysWF(baysFile.c_str());
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor)
+        for (int lot = 1; lot <= TOTAL_LOT_PER_FLOOR; ++lot)
+            baysWF << "CAR " << makeLotNo(floor, lot) << ' '
+                   << bayTypeName(BENCH_MIX[lot - 1]) << '\n';
+    baysWF.close();
+
+    AutoParkingSystem benchVeh;
+    benchVeh.setSite(site);
+    benchVeh.setVehicleType("CAR");
+    benchVeh.readFile();
+    benchVeh.clearAll();
+
+    int parks = 0, unparks = 0, failed = 0;
+    double parkSecs = 0.0, unparkSecs = 0.0;
+    time_t now = currentTime();
+    while (parks + unparks < total) {
+        int round = min(TOTAL_ALL_LOT, (total - parks - unparks + 1) / 2);
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < round; ++i) {
+                AutoParkingSystem gateVeh;
+                gateVeh.setSite(site);
+                gateVeh.setVehicleType("CAR");
+                gateVeh.setPlateNo("BENCH" + to_string(i));
+                gateVeh.setPinNo("123456");
+                gateVeh.setBayType(bayTypeName(
+                    BENCH_MIX[i % TOTAL_LOT_PER_FLOOR]));
+                gateVeh.setDateTime(now);
+                chrono::steady_clock::time_point start =
+                    chrono::steady_clock::now();
+                ApsStatus result = pass == 0 ? gateVeh.park()
+                                             : gateVeh.unpark();
+                chrono::duration<double> taken =
+                    chrono::steady_clock::now() - start;
+                if (result != APS_OK) ++failed;
+                if (pass == 0) {
+                    parkSecs += taken.count();
+                    ++parks;
+                } else {
+                    unparkSecs += taken.count();
+                    ++unparks;
+                }
+            }
+            now += 3600;
+        }
+    }
+    benchVeh.readFile();
+    benchVeh.clearAll();
+    remove(baysFile.c_str());
+
+    double secs = parkSecs + unparkSecs;
+    out << ",\"operations\":" << parks + unparks
+        << ",\"ops_per_sec\":" << (secs > 0 ? (parks + unparks) / secs : 0)
+        << ",\"park_us\":" << (parks ? parkSecs / parks * 1e6 : 0)
+        << ",\"unpark_us\":" << (unparks ? unparkSecs / unparks * 1e6 : 0);
+    return failed;
+}
+
+
+// The allocator alone: each pick frees the oldest bay once 90 are taken
+int benchAllocator(int total, ostream &out) {
+    BayAllocator bays;
+    for (int floor = 0; floor < TOTAL_FLOOR; ++floor)
+        for (int lot = 1; lot <= TOTAL_LOT_PER_FLOOR; ++lot)
+            bays.setBayType(floor, lot, BENCH_MIX[lot - 1]);
+    Random rng(getRandomSeed());
+    deque<pair<int, int> > taken;
+    int floor, lot, allocs = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < total * 100; ++i) {
+        if (bays.allocate(BENCH_MIX[i % TOTAL_LOT_PER_FLOOR], floor, lot,
+                          rng)) {
+            taken.push_back(make_pair(floor, lot));
+            ++allocs;
+        }
+        if ((int)taken.size() >= TOTAL_ALL_LOT * 9 / 10) {
+            bays.release(taken.front().first, taken.front().second);
+            taken.pop_front();
+        }
+    }
+    chrono::duration<double> secs = chrono::steady_clock::now() - start;
+    out << ",\"allocations\":" << allocs
+        << ",\"allocate_ns\":" << (allocs ? secs.count() / allocs * 1e9 : 0);
+    return 0;
+}
+
+
+// Billing alone: stays of up to 30 days through the pricing table, the
+// total is kept so the work is not optimised away
+int benchBilling(int total, ostream &out) {
+    shared_ptr<const PricingTable> pricing = getPricing();
+    time_t now = currentTime();
+    Money billed = 0;
+    int bills = total * 100;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < bills; ++i)
+        billed += pricing->calcCharges(i % 2 ? "CAR" : "MOTORCYCLE",
+                                       now + i * 600LL,
+                                       (i * 7919LL) % 2592000, 0.5);
+    chrono::duration<double> secs = chrono::steady_clock::now() - start;
+    out << ",\"bills\":" << bills
+        << ",\"billed\":" << formatMoney(billed)
+        << ",\"billing_ns\":" << (bills ? secs.count() / bills * 1e9 : 0);
+    return 0;
+}
+
+
+// Fuzzy unparks: garages of made up plates, each unparked through
+// unpark() by a read with two characters wrong, recall counts the reads
+// that unparked the right vehicle. Then the index alone on up to
+// BENCH_MAX_PLATES plates, each looked up with the same misreads
+int benchFuzzy(string site, int total, ostream &out) {
+    vector<string> plateNos;
+    const string chars = "ABCDEFGHJKMNPRTUVWXY0123456789";
+    for (int i = 0; i < min(total * 100, BENCH_MAX_PLATES); ++i) {
+        string plate = "";
+        uint64_t n = i * 2654435761U % 1000003;
+        for (int c = 0; c < 7; ++c) {
+            plate += chars[n % chars.length()];
+            n = n / chars.length() + (c + 1) * 7919ULL * (i + 1);
+        }
+        plateNos.push_back(plate);
+    }
+
+    AutoParkingSystem benchVeh;
+    benchVeh.setSite(site);
+    benchVeh.setVehicleType("CAR");
+    time_t now = currentTime();
+    int queries = 0, hits = 0;
+    double fuzzySecs = 0.0;
+    for (int first = 0; queries < total; first += TOTAL_ALL_LOT) {
+        vector<string> parked;
+        for (int i = 0; i < TOTAL_ALL_LOT && queries + i < total; ++i) {
+            AutoParkingSystem gateVeh;
+            gateVeh.setSite(site);
+            gateVeh.setVehicleType("CAR");
+            gateVeh.setPlateNo(plateNos[(first + i) % plateNos.size()]);
+            gateVeh.setPinNo("123456");
+            gateVeh.setDateTime(now);
+            if (gateVeh.park() == APS_OK)
+                parked.push_back(gateVeh.getPlateNo());
+        }
+        now += 3600;
+        for (int i = 0; i < (int)parked.size(); ++i) {
+            string read = parked[i];
+            read[1] = read[1] == 'O' ? '0' : 'X';
+            read[4] = read[4] == '8' ? 'B' : 'Y';
+            AutoParkingSystem gateVeh;
+            gateVeh.setSite(site);
+            gateVeh.setVehicleType("CAR");
+            gateVeh.setPlateNo(read);
+            gateVeh.setPinNo("123456");
+            gateVeh.setDateTime(now);
+            chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            ApsStatus result = gateVeh.unpark();
+            chrono::duration<double> taken =
+                chrono::steady_clock::now() - start;
+            fuzzySecs += taken.count();
+            ++queries;
+            if (result == APS_OK &&
+                gateVeh.getPlateNo().compare(parked[i]) == 0)
+                ++hits;
+        }
+        // Vehicles a read missed are taken out for the next garage
+        benchVeh.readFile();
+        benchVeh.clearAll();
+        now += 3600;
+    }
+
+    PlateIndex plates;
+    for (int i = 0; i < (int)plateNos.size(); ++i)
+        plates.add(plateNos[i]);
+    int searches = min(total, (int)plateNos.size()), found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < searches; ++i) {
+        const string &plate = plateNos[i * 97LL % plateNos.size()];
+        string read = plate;
+        read[1] = read[1] == 'O' ? '0' : 'X';
+        read[4] = read[4] == '8' ? 'B' : 'Y';
+        vector<string> close = plates.search(read, PLATE_MAX_EDITS);
+        if (find(close.begin(), close.end(), plate) != close.end())
+            ++found;
+    }
+    chrono::duration<double> searchSecs = chrono::steady_clock::now() - start;
+
+    out << ",\"fuzzy_unparks\":" << queries
+        << ",\"fuzzy_us\":" << (queries ? fuzzySecs / queries * 1e6 : 0)
+        << ",\"fuzzy_recall\":" << (queries ? (double)hits / queries : 0)
+        << ",\"plates\":" << plates.getTotalPlates()
+        << ",\"search_us\":"
+        << (searches ? searchSecs.count() / searches * 1e6 : 0)
+        << ",\"search_recall\":"
+        << (searches ? (double)found / searches : 0);
+    return 0;
+}
+
+
+// Reports & billing of stays by floor on 1, 2, 4 .. every core. Floor A
+// has half of the stays, B a quarter & so on, so the other workers only
+// keep busy by stealing chunks of A & B
+int benchScaling(int total, ostream &out) {
+    vector<Stay> benchStays(min(total * 200, BENCH_MAX_STAYS));
+    time_t now = currentTime();
+    for (int i = 0; i < (int)benchStays.size(); ++i) {
+        Stay &stay = benchStays[i];
+        int floor = 0;
+        while (floor + 1 < TOTAL_FLOOR && (i >> floor) & 1) ++floor;
+        stay.lot_no = makeLotNo(floor, i % TOTAL_LOT_PER_FLOOR + 1);
+        stay.plate_no = "BENCH" + to_string(i);
+        stay.vehicle_type = i % 3 ? "CAR" : "MOTORCYCLE";
+        stay.date_time_in = now + i * 60LL % 604800;
+        stay.date_time_out = stay.date_time_in + i * 7919LL % 172800;
+        stay.charges = 0;
+        stay.is_parked = false;
+    }
+    int cores = max(1u, thread::hardware_concurrency());
+    double oneCoreSecs = 0.0;
+    out << ",\"scaling\":[";
+    for (int threads = 1; ; threads = min(cores, threads * 2)) {
+        TaskPool pool(threads);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        buildReport(benchStays, pool);
+        billStays(benchStays, pool);
+        chrono::duration<double> taken = chrono::steady_clock::now() - start;
+        if (threads == 1) oneCoreSecs = taken.count();
+        out << (threads == 1 ? "" : ",") << "{\"threads\":" << threads
+            << ",\"stays_per_sec\":"
+            << (taken.count() > 0 ? 2 * benchStays.size() / taken.count()
+                                  : 0)
+            << ",\"speedup\":"
+            << (taken.count() > 0 ? oneCoreSecs / taken.count() : 0)
+            << ",\"stolen\":" << pool.getTotalStolen() << '}';
+        if (threads == cores) break;
+    }
+    out << ']';
+    return 0;
+}
+
+
+// Allocation on 1, 2, 4 .. every core: each floor of each garage is a
+// task on the pool that keeps its floor 90% full, the floors touching
+// only their own shard of the allocator. Floor A gets half the
+// vehicles, B a quarter & so on, so idle workers steal the other floors
+int benchAllocScaling(int total, ostream &out) {
+    vector<int> floorAllocs(BENCH_GARAGES * TOTAL_FLOOR);
+    int cores = max(1u, thread::hardware_concurrency());
+    double oneCoreSecs = 0.0;
+    out << ",\"alloc_scaling\":[";
+    for (int threads = 1; ; threads = min(cores, threads * 2)) {
+        unique_ptr<BayAllocator[]> garages(new BayAllocator[BENCH_GARAGES]);
+        TaskPool pool(threads);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int g = 0; g < BENCH_GARAGES; ++g) {
+            for (int floor = 0; floor < TOTAL_FLOOR; ++floor) {
+                int shard = g * TOTAL_FLOOR + floor;
+                pool.submit(shard, bind(churnFloor, &garages[g], floor,
+                                        total * 100 >> (floor + 1),
+                                        BENCH_MIX, &floorAllocs[shard]));
+            }
+        }
+        pool.wait();
+        chrono::duration<double> taken = chrono::steady_clock::now() - start;
+        int64_t allocs = 0;
+        for (int i = 0; i < (int)floorAllocs.size(); ++i)
+            allocs += floorAllocs[i];
+        if (threads == 1) oneCoreSecs = taken.count();
+        out << (threads == 1 ? "" : ",") << "{\"threads\":" << threads
+            << ",\"allocations\":" << allocs
+            << ",\"allocs_per_sec\":"
+            << (taken.count() > 0 ? allocs / taken.count() : 0)
+            << ",\"speedup\":"
+            << (taken.count() > 0 ? oneCoreSecs / taken.count() : 0)
+            << ",\"stolen\":" << pool.getTotalStolen() << '}';
+        if (threads == cores) break;
+    }
+    out << ']';
+    return 0;
+}
+
+
+// Ingestion on 1, 2, 4 .. 32 sites: the same number of events as a
+// replay (scratch sites), each site parks & unparks 20 cars a round
+int benchIngest(int total, ostream &out) {
+    int ingested = max(BENCH_MAX_SITES * 40, total), failed = 0;
+    time_t now = currentTime();
+    double oneSiteSecs = 0.0;
+    out << ",\"ingest_scaling\":[";
+    for (int totalSites = 1; totalSites <= BENCH_MAX_SITES; totalSites *= 2) {
+        stringstream events;
+        int rounds = max(1, ingested / (totalSites * 40));
+        time_t when = now;
+        for (int round = 0; round < rounds; ++round, when += 7200)
+            for (int pass = 0; pass < 2; ++pass)
+                for (int s = 0; s < totalSites; ++s)
+                    for (int i = 0; i < 20; ++i)
+                        events << when + pass * 3600 + i
+                               << (pass ? " UNPARK" : " PARK") << " CAR B"
+                               << s << 'X' << i << " 123456 bench" << s
+                               << '\n';
+        stringstream receipts;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        ingestEvents(events, receipts, true);
+        chrono::duration<double> taken = chrono::steady_clock::now() - start;
+        // Every event but the last line (the replay summary) is a receipt
+        string receipt;
+        int totalOk = 0, totalEvents = rounds * totalSites * 40;
+        while (getline(receipts, receipt))
+            if (receipt.find("\"status\":\"OK\"") != string::npos) ++totalOk;
+        failed += totalEvents - totalOk;
+        if (totalSites == 1) oneSiteSecs = taken.count() / totalEvents;
+        double perEvent = taken.count() / totalEvents;
+        out << (totalSites == 1 ? "" : ",") << "{\"sites\":" << totalSites
+            << ",\"events\":" << totalEvents
+            << ",\"events_per_sec\":" << (perEvent > 0 ? 1 / perEvent : 0)
+            << ",\"speedup\":"
+            << (perEvent > 0 ? oneSiteSecs / perEvent : 0) << '}';
+    }
+    out << ']';
+    return failed;
+}
+
+
+// perf [scale], perf record [file] or perf check [file] [threshold],
+// record & check always run at scale 1 so they compare like for like
+bool runPerf(const vector<string> &args, ostream &out) {
+    string mode = args.size() > 1 ? args[1] : "";
+    bool isRecord = mode.compare("record") == 0,
+         isCheck = mode.compare("check") == 0;
+    if ((!isRecord && !isCheck && args.size() > 2) ||
+        (isRecord && args.size() > 3)) {
+        out << "{\"command\":\"perf\",\"status\":\"BAD_COMMAND\"}\n";
+        return false;
+    }
+    int scale = isRecord || isCheck || mode.empty() ? 1 : atoi(mode.c_str());
+    string fileName = args.size() > 2 ? args[2] : PERF_BASELINE_FILE;
+    double threshold = args.size() > 3 ? atof(args[3].c_str())
+                                       : PERF_THRESHOLD;
+
+    vector<PerfResult> baseline, results;
+    string status = "OK";
+    if (isCheck && !readPerfBaseline(fileName, baseline)) {
+        status = "NO_BASELINE";
+    } else if (!runPerfScenarios(scale, results)) {
+        status = "NO_FIXTURES";
+    } else {
+        if (isRecord && !writePerfBaseline(fileName, results))
+            status = "WRITE_FAILED";
+    }
+    vector<string> regressions = findRegressions(baseline, results,
+                                                 threshold);
+    if (status.compare("OK") == 0 && !regressions.empty())
+        status = "REGRESSED";
+
+    out << "{\"command\":\"perf\",\"status\":" << jsonString(status)
+        << ",\"scale\":" << max(1, scale);
+    if (isRecord || isCheck)
+        out << ",\"baseline\":" << jsonString(fileName);
+    if (isCheck)
+        out << ",\"threshold\":" << fixed << setprecision(2) << threshold;
+    out << ",\"fixtures\":" << jsonString(findFixtureDir())
+        << ",\"scenarios\":[";
+    for (int i = 0; i < (int)results.size(); ++i) {
+        if (i > 0) out << ',';
+        printPerfResult(out, results[i]);
+    }
+    out << "],\"regressions\":[";
+    for (int i = 0; i < (int)regressions.size(); ++i)
+        out << (i > 0 ? "," : "") << jsonString(regressions[i]);
+    out << "]}\n";
+    return status.compare("OK") == 0;
+}
+
+
+void showReports() {
+    vector<Stay> stays;
+    AutoParkingSystem car;
+    car.setSite(currentSite);
+    car.setVehicleType("CAR");
+    car.readFile();
+    car.getAllStays(stays);
+    AutoParkingSystem moto;
+    moto.setSite(currentSite);
+    moto.setVehicleType("MOTORCYCLE");
+    moto.readFile();
+    moto.getAllStays(stays);
+
+    TaskPool pool;
+    Report rep = buildReport(stays, pool);
+
+    // Occupancy heatmap, darker means more vehicle-hours
+    const string shades = " .:-=+*#%@";
+    const string days[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    u32 maxHours = 0;
+    for (int d = 0; d < 7; ++d)
+        for (int h = 0; h < 24; ++h)
+            maxHours = max(maxHours, rep.occupancy[d][h]);
+    cout << "\tOCCUPANCY BY HOUR (" << stays.size() << " stays, max "
+         << maxHours << " vehicle-hours)\n"
+         << "     0     6     12    18    23\n";
+    for (int d = 0; d < 7; ++d) {
+        cout << days[d] << "  ";
+        for (int h = 0; h < 24; ++h) {
+            int shade = maxHours == 0 ? 0 :
+                (int)((unsigned long long)rep.occupancy[d][h] * 9 / maxHours);
+            cout << shades[shade];
+        }
+        cout << endl;
+    }
+
+    cout << "\n\tAVERAGE DWELL TIME BY FLOOR\n";
+    for (int f = 0; f < TOTAL_FLOOR; ++f) {
+        if (rep.dwell_count[f] == 0) continue;
+        long avg = (long)(rep.dwell_sum[f] / rep.dwell_count[f]);
+        cout << "Floor " << (char)('A' + f) << ": "
+             << avg / 3600 << "h:" << avg / 60 % 60 << "m ("
+             << rep.dwell_count[f] << " stays)\n";
+    }
+
+    // Bands at their base rates, the pricing rules (time of week,
+    // occupancy) only show in what was billed
+    cout << "\n\tNOMINAL REVENUE BY TARIFF BAND (BASE RATES)\n";
+    int start = 0;
+    for (int b = 0; b < TOTAL_CAR_BAND; ++b) {
+        cout << "Car " << setw(2) << right << start + 1 << "-"
+             << setw(2) << left << CAR_BAND_END[b] << "hr @ RM"
+             << formatMoney(CAR_BAND_RATE[b]) << ": " << rep.band_hours[b]
+             << " hrs, RM" << formatMoney(rep.band_revenue[b]) << endl;
+        start = CAR_BAND_END[b];
+    }
+    cout << "Motorcycle @ RM" << formatMoney(MOTO_DAY_RATE) << "/day: "
+         << rep.moto_days << " days, RM" << formatMoney(rep.moto_revenue)
+         << endl;
+    cout << "Billed: car RM" << formatMoney(rep.car_charged)
+         << ", motorcycle RM" << formatMoney(rep.moto_charged) << endl;
+
+    cout << "\n\tLONGEST STAYS\n";
+    for (int i = 0; i < (int)rep.top_stays.size(); ++i) {
+        Stay &stay = rep.top_stays[i];
+        long sec = (long)(stay.date_time_out - stay.date_time_in);
+        cout << setw(10) << left << stay.plate_no
+             << setw(5) << left << stay.lot_no
+             << sec / 3600 << "h:" << sec / 60 % 60 << "m"
+             << (stay.is_parked ? " (still parked)" : "") << endl;
+    }
+}
+
+
 void pauseScreen() {
     char c;
     cout << "\nPress enter to continue..";
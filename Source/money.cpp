@@ -0,0 +1,56 @@
+#include <cctype>        // isdigit
+#include <cstdlib>       // strtod
+#include "money.h"
+using namespace std;
+
+// Digits read exactly, more could overflow a Money, 2^63 sen is its limit
+const int MAX_EXACT_DIGITS = 16;
+const double MONEY_LIMIT = 9223372036854775808.0;
+
+
+//==============================================================
+string formatMoney(Money amount) {
+    string sign = amount < 0 ? "-" : "";
+    Money whole = (amount < 0 ? -amount : amount);
+    Money sen = whole % SEN_PER_RINGGIT;
+    return sign + to_string(whole / SEN_PER_RINGGIT) + '.' +
+           (sen < 10 ? "0" : "") + to_string(sen);
+}
+
+
+// Digits are read exactly, a third decimal, a long amount (or an
+// exponent from an old double) falls back to rounding
+//==============================================================
+bool parseMoney(string text, Money &amount) {
+    string::size_type i = 0;
+    bool isNegative = !text.empty() && text[0] == '-';
+    if (isNegative) ++i;
+    Money whole = 0, sen = 0;
+    int totalDigits = 0, totalDecimals = 0;
+    for (; i < text.length() && isdigit(text[i]); ++i, ++totalDigits)
+        if (totalDigits < MAX_EXACT_DIGITS)
+            whole = whole * 10 + (text[i] - '0');
+    if (i < text.length() && text[i] == '.') {
+        for (++i; i < text.length() && isdigit(text[i]) &&
+                  totalDecimals < 2; ++i, ++totalDecimals)
+            sen = sen * 10 + (text[i] - '0');
+    }
+    if (totalDecimals == 1) sen *= 10;
+    if (i == text.length() && totalDigits + totalDecimals > 0 &&
+        totalDigits <= MAX_EXACT_DIGITS) {
+        amount = whole * SEN_PER_RINGGIT + sen;
+        if (isNegative) amount = -amount;
+        return true;
+    }
+
+    // Anything else a double could have been written as
+    char *end;
+    double value = strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0') return false;
+    value *= SEN_PER_RINGGIT;
+    value = value < 0 ? value - 0.5 : value + 0.5;
+    // Not inf, nan or more sen than a Money holds
+    if (!(value > -MONEY_LIMIT && value < MONEY_LIMIT)) return false;
+    amount = (Money)value;
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef MONEY_H
+#define MONEY_H
+#include <cstdint>
+#include <string>
+
+// Amounts of money in sen (RM0.01) so totals add up exactly
+typedef int64_t Money;
+const Money SEN_PER_RINGGIT = 100;
+
+// "12.50" for 1250 sen
+std::string formatMoney(Money);
+// Read "12.5", "12.50" or "12" as sen (files written with doubles
+// too, rounded to the nearest sen), false if not an amount or out of
+// the range of Money
+bool parseMoney(std::string, Money &);
+
+#endif
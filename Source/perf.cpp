@@ -0,0 +1,1008 @@
+#include <algorithm>     // min, max, nth_element
+#include <chrono>        // steady_clock
+#include <cmath>         // llround
+#include <cstdlib>       // atoi, atof, getenv
+#include <fstream>       // ifstream, ofstream
+#include <iomanip>       // setprecision
+#include <iterator>      // istreambuf_iterator
+#include <map>           // map
+#include <atomic>        // atomic
+#include <set>           // set
+#include <sstream>       // istringstream, ostringstream
+#include <thread>        // thread
+#include <pthread.h>     // pthread_setschedparam, SCHED_IDLE
+#include <unistd.h>      // readlink
+#include "aps.h"
+#include "audit.h"
+#include "clock.h"
+#include "perf.h"
+#include "pool.h"
+#include "pricing.h"
+#include "report.h"
+#include "secret.h"
+#include "snapshot.h"
+using namespace std;
+
+const int PERF_REPEATS = 3;
+const int PERF_FILL = TOTAL_ALL_LOT * 9 / 10;   // Garage kept 90% full
+const string PERF_PIN = "123456";
+const int PERF_BOOKINGS = 100000;   // Bookings of a garage per scale
+const string PERF_FIXTURES[2] = { "apscar.dat", "apsmoto.dat" };
+// Rules pricing_exact checks the pricing table with
+const string PERF_RATES = "TIME WEEKDAY 7 10 1.5\n"
+                          "TIME SAT 0 24 0.8\n"
+                          "TIME ALL 22 24 1.25\n"
+                          "OCCUPANCY 80 1.2\n"
+                          "OCCUPANCY 95 1.5\n";
+// Start of an entry a crash cut short: a park, half its lot's length
+const string JOURNAL_TORN = string("P\x05\0", 3);
+typedef chrono::steady_clock PerfClock;
+
+// What every scenario gets: the scale, the plates of the fixtures &
+// made up ones, & a time that only moves forward between scenarios
+struct PerfSetup {
+    int scale;
+    int total_fixtures;
+    vector<string> plates;
+    time_t now;
+};
+
+
+// Directory holding the fixtures: APS_FIXTURE_DIR if set, else
+// MockData next to the program or its parent (the repo layout), else
+// of the working directory or its parent. Empty if none has them
+//==============================================================
+string findFixtureDir() {
+    vector<string> dirs;
+    const char *envDir = getenv("APS_FIXTURE_DIR");
+    if (envDir && *envDir) {
+        dirs.push_back(string(envDir) + '/');
+    } else {
+        char exePath[4096];
+        ssize_t len = readlink("/proc/self/exe", exePath,
+                               sizeof(exePath) - 1);
+        if (len > 0) {
+            string exeDir(exePath, len);
+            exeDir.erase(exeDir.rfind('/') + 1);
+            dirs.push_back(exeDir + PERF_FIXTURE_DIR + '/');
+            dirs.push_back(exeDir + "../" + PERF_FIXTURE_DIR + '/');
+        }
+        dirs.push_back(PERF_FIXTURE_DIR + '/');
+        dirs.push_back("../" + PERF_FIXTURE_DIR + '/');
+    }
+    for (int i = 0; i < (int)dirs.size(); ++i) {
+        ifstream rFile((dirs[i] + PERF_FIXTURES[0]).c_str());
+        if (rFile.good()) return dirs[i];
+    }
+    return "";
+}
+
+
+// Plates of the fixtures ("lot plate time pin" lines), then made up
+// plates until there are enough to fill every site & some more
+//==============================================================
+static void loadPlates(string fixtureDir, PerfSetup &setup) {
+    string lotNo, plateNo;
+    set<string> seen;
+    for (int i = 0; i < 2; ++i) {
+        ifstream rFile((fixtureDir + PERF_FIXTURES[i]).c_str());
+        string line;
+        while (getline(rFile, line)) {
+            istringstream ss(line);
+            if (ss >> lotNo >> plateNo && seen.insert(plateNo).second)
+                setup.plates.push_back(plateNo);
+        }
+    }
+    setup.total_fixtures = setup.plates.size();
+    for (int i = 0; (int)setup.plates.size() <
+                    (setup.scale + 1) * TOTAL_ALL_LOT; ++i)
+        if (seen.insert("PERF" + to_string(i)).second)
+            setup.plates.push_back("PERF" + to_string(i));
+}
+
+
+// Scratch site number n of the run, every one starts out empty
+//==============================================================
+static string perfSite(int n) {
+    return makeScratchSite(PERF_SITE + to_string(n));
+}
+
+
+// Park or unpark a car of a perf site through the library
+//==============================================================
+static ApsStatus perfGate(bool isPark, string site, string plateNo,
+                          time_t when) {
+    AutoParkingSystem perfVeh;
+    perfVeh.setSite(site);
+    perfVeh.setVehicleType("CAR");
+    perfVeh.setPlateNo(plateNo);
+    perfVeh.setPinNo(PERF_PIN);
+    perfVeh.setDateTime(when);
+    return isPark ? perfVeh.park() : perfVeh.unpark();
+}
+
+
+// Throughput & latency percentiles of the timed operations
+//==============================================================
+static PerfResult summarize(string name, vector<double> &latencies,
+                            int failed) {
+    PerfResult result;
+    result.name = name;
+    result.operations = latencies.size();
+    result.failed = failed;
+    result.ops_per_sec = result.p50_us = result.p99_us = 0.0;
+    if (latencies.empty()) return result;
+
+    double total = 0.0;
+    for (int i = 0; i < (int)latencies.size(); ++i)
+        total += latencies[i];
+    result.ops_per_sec = total > 0 ? latencies.size() / total : 0.0;
+    int p50 = latencies.size() / 2, p99 = latencies.size() * 99 / 100;
+    nth_element(latencies.begin(), latencies.begin() + p50, latencies.end());
+    result.p50_us = latencies[p50] * 1e6;
+    nth_element(latencies.begin(), latencies.begin() + p99, latencies.end());
+    result.p99_us = latencies[p99] * 1e6;
+    return result;
+}
+
+
+static double secondsSince(PerfClock::time_point start) {
+    return chrono::duration<double>(PerfClock::now() - start).count();
+}
+
+
+// The last lots of garages kept 90% full, one garage per scale, the
+// burst is unparked again (untimed) before the next one
+//==============================================================
+static PerfResult perfParkBurst(PerfSetup &setup) {
+    vector<double> latencies;
+    int failed = 0;
+    const vector<string> &plates = setup.plates;
+    for (int s = 0; s < setup.scale; ++s)
+        for (int i = 0; i < PERF_FILL; ++i)
+            perfGate(true, perfSite(s), plates[s * TOTAL_ALL_LOT + i],
+                     setup.now);
+    for (int round = 0; round < 100; ++round) {
+        setup.now += 3600;
+        string site = perfSite(round % setup.scale);
+        int first = round % setup.scale * TOTAL_ALL_LOT;
+        for (int i = first + PERF_FILL; i < first + TOTAL_ALL_LOT; ++i) {
+            PerfClock::time_point start = PerfClock::now();
+            if (perfGate(true, site, plates[i], setup.now) != APS_OK)
+                ++failed;
+            latencies.push_back(secondsSince(start));
+        }
+        for (int i = first + PERF_FILL; i < first + TOTAL_ALL_LOT; ++i)
+            perfGate(false, site, plates[i], setup.now + 60);
+    }
+    return summarize("park_burst", latencies, failed);
+}
+
+
+// Every car of full garages leaves, each unpark rewrites the file
+//==============================================================
+static PerfResult perfMassUnpark(PerfSetup &setup) {
+    vector<double> latencies;
+    int failed = 0;
+    const vector<string> &plates = setup.plates;
+    for (int round = 0; round < 20; ++round) {
+        string site = perfSite(round % setup.scale);
+        int first = round % setup.scale * TOTAL_ALL_LOT;
+        for (int i = first; i < first + TOTAL_ALL_LOT; ++i)
+            perfGate(true, site, plates[i], setup.now);
+        setup.now += 3 * 3600;
+        for (int i = first; i < first + TOTAL_ALL_LOT; ++i) {
+            PerfClock::time_point start = PerfClock::now();
+            if (perfGate(false, site, plates[i], setup.now) != APS_OK)
+                ++failed;
+            latencies.push_back(secondsSince(start));
+        }
+    }
+    return summarize("mass_unpark", latencies, failed);
+}
+
+
+// What the admin menu does for every full garage: read it, sort it
+// each way & search it by plate & by lot
+//==============================================================
+static PerfResult perfAdminSort(PerfSetup &setup) {
+    vector<double> latencies;
+    int failed = 0;
+    const vector<string> &plates = setup.plates;
+    for (int s = 0; s < setup.scale; ++s)
+        for (int i = 0; i < TOTAL_ALL_LOT; ++i)
+            perfGate(true, perfSite(s), plates[s * TOTAL_ALL_LOT + i],
+                     setup.now);
+    for (int i = 0; i < max(1, 5000 / setup.scale); ++i) {
+        PerfClock::time_point start = PerfClock::now();
+        for (int s = 0; s < setup.scale; ++s) {
+            AutoParkingSystem adminVeh;
+            adminVeh.setSite(perfSite(s));
+            adminVeh.setVehicleType("CAR");
+            adminVeh.readFile();
+            adminVeh.sortByPlateNo();
+            string lotNo = adminVeh.getLotByPlateNo(
+                plates[s * TOTAL_ALL_LOT + i % TOTAL_ALL_LOT]);
+            adminVeh.sortByLotNo();
+            string plateNo = adminVeh.getPlateByLotNo(makeLotNo(
+                i % TOTAL_FLOOR, i / TOTAL_FLOOR % TOTAL_LOT_PER_FLOOR + 1));
+            adminVeh.sortByDateTimeIn();
+            if (lotNo.compare("N/A") == 0 || plateNo.compare("N/A") == 0)
+                ++failed;
+        }
+        latencies.push_back(secondsSince(start));
+    }
+    return summarize("admin_sort", latencies, failed);
+}
+
+
+// Stays of up to 90 days times the scale, at any hour of the week &
+// occupancy, through getPricing() like every unpark
+//==============================================================
+static PerfResult perfLongStay(PerfSetup &setup) {
+    vector<double> latencies;
+    Money billed = 0;
+    int64_t longest = 90LL * 86400 * setup.scale;
+    for (int i = 0; i < 500000; ++i) {
+        PerfClock::time_point start = PerfClock::now();
+        billed += getPricing()->calcCharges(i % 2 ? "CAR" : "MOTORCYCLE",
+                                            setup.now + i * 600LL % 604800,
+                                            i * 7919LL % longest,
+                                            i % 100 / 100.0);
+        latencies.push_back(secondsSince(start));
+    }
+    return summarize("long_stay", latencies, billed < 0 ? 1 : 0);
+}
+
+
+// Free lot searches of a garage holding 100,000 bookings per scale,
+// a lot is booked every other hour (lots take turns), & bookings that
+// clash with one the plate already has, which must be turned down
+//==============================================================
+static PerfResult perfAvailability(PerfSetup &setup) {
+    vector<double> latencies;
+    int failed = 0;
+    int perLot = PERF_BOOKINGS * setup.scale / TOTAL_ALL_LOT;
+    time_t first = setup.now + 86400;
+    vector<Stay> stays;
+    Stay booking;
+    booking.vehicle_type = "CAR";
+    booking.charges = 0;
+    booking.is_parked = false;
+    for (int k = 0; k < TOTAL_ALL_LOT; ++k) {
+        booking.lot_no = makeLotNo(k / TOTAL_LOT_PER_FLOOR,
+                                   k % TOTAL_LOT_PER_FLOOR + 1);
+        for (int j = 0; j < perLot; ++j) {
+            booking.plate_no = "BOOK" + to_string(k * perLot + j);
+            booking.date_time_in = first + j * 7200LL + k % 2 * 3600;
+            booking.date_time_out = booking.date_time_in + 3600;
+            stays.push_back(booking);
+        }
+    }
+    AutoParkingSystem resvVeh;
+    resvVeh.setSite(perfSite(0));
+    resvVeh.setVehicleType("CAR");
+    resvVeh.setDateTime(setup.now);
+    resvVeh.readFile();
+    if (resvVeh.addBookings(stays) != (int)stays.size()) ++failed;
+
+    for (int i = 0; i < 20000; ++i) {
+        const Stay &own = stays[i * 7919LL % stays.size()];
+        time_t from = first + i * 104729LL % (perLot * 2) * 3600 +
+                      i % 2 * 1800;
+        PerfClock::time_point start = PerfClock::now();
+        // Some lot is free for any half hour within an hour, but one
+        // plate is never booked into two places at once
+        string lotNo = resvVeh.findFreeLot(from, from + 1800);
+        resvVeh.setPlateNo(own.plate_no);
+        bool isClash = resvVeh.reserveLot(own.date_time_in + 600,
+                                          own.date_time_out + 600);
+        latencies.push_back(secondsSince(start));
+        if (lotNo.compare("N/A") == 0 || isClash) ++failed;
+    }
+    return summarize("availability", latencies, failed);
+}
+
+
+// Cost of hashing a secret & checking it (right & wrong) with the
+// given rounds, what every park & unpark or admin login pays
+//==============================================================
+static PerfResult perfHash(string name, unsigned int rounds, int total) {
+    vector<double> latencies;
+    int failed = 0;
+    for (int i = 0; i < total; ++i) {
+        string secret = to_string(100000 + i % 900000);
+        PerfClock::time_point start = PerfClock::now();
+        string stored = hashSecret(secret, rounds);
+        bool isOk = verifySecret(secret, stored, rounds) &&
+                    !verifySecret(secret + '0', stored, rounds);
+        latencies.push_back(secondsSince(start));
+        if (!isOk || needsRehash(stored)) ++failed;
+    }
+    return summarize(name, latencies, failed);
+}
+
+static PerfResult perfPinHash(PerfSetup &setup) {
+    return perfHash("pin_hash", PIN_HASH_ROUNDS, 20000 * setup.scale);
+}
+
+static PerfResult perfAdminHash(PerfSetup &setup) {
+    return perfHash("admin_hash", ADMIN_HASH_ROUNDS, 50 * setup.scale);
+}
+
+
+// What the admin menu does to every garage, over & over until done,
+// except while paused. It runs on a core the gates leave idle only &
+// never sleeps (a woken thread would be owed a time slice), else on 1
+// core the p99 of the gates would be the time slice of the scheduler,
+// not what the admin queries hold them up
+//==============================================================
+static void perfAdminQueries(const PerfSetup *setup, atomic<bool> *isDone,
+                             atomic<bool> *isPaused, atomic<int> *queries) {
+    sched_param idle = {};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &idle);
+    while (!*isDone) {
+        for (int s = 0; s < setup->scale && !*isPaused; ++s) {
+            AutoParkingSystem adminVeh;
+            adminVeh.setSite(perfSite(s));
+            adminVeh.setVehicleType("CAR");
+            adminVeh.readFile();
+            adminVeh.sortByPlateNo();
+            adminVeh.getLotByPlateNo(setup->plates[s * TOTAL_ALL_LOT]);
+            adminVeh.sortByLotNo();
+            adminVeh.getPlateByLotNo(makeLotNo(0, 1));
+            adminVeh.sortByDateTimeIn();
+            ++*queries;
+        }
+        this_thread::yield();
+    }
+}
+
+
+// Gates of a garage kept 90% full, every other round while another
+// thread runs the admin queries: only the p99 of the gates counts, &
+// with the admin queries it must not be slower than without by more
+// than PERF_THRESHOLD percent
+//==============================================================
+static PerfResult perfGateUnderAdmin(PerfSetup &setup) {
+    vector<double> latencies, unloaded;
+    int failed = 0;
+    const vector<string> &plates = setup.plates;
+    for (int s = 0; s < setup.scale; ++s)
+        for (int i = 0; i < PERF_FILL; ++i)
+            perfGate(true, perfSite(s), plates[s * TOTAL_ALL_LOT + i],
+                     setup.now);
+    atomic<bool> isDone(false), isPaused(true);
+    atomic<int> queries(0);
+    thread admin(perfAdminQueries, &setup, &isDone, &isPaused, &queries);
+    for (int round = 0; round < 200; ++round) {
+        isPaused = round % 2 == 0;
+        vector<double> &timed = isPaused ? unloaded : latencies;
+        setup.now += 3600;
+        string site = perfSite(round / 2 % setup.scale);
+        int first = round / 2 % setup.scale * TOTAL_ALL_LOT;
+        for (int j = 0; j < 2; ++j) {
+            for (int i = first + PERF_FILL; i < first + TOTAL_ALL_LOT;
+                 ++i) {
+                PerfClock::time_point start = PerfClock::now();
+                if (perfGate(j == 0, site, plates[i],
+                             setup.now + j * 60) != APS_OK)
+                    ++failed;
+                timed.push_back(secondsSince(start));
+            }
+        }
+    }
+    isDone = true;
+    admin.join();
+    // Admin queries that never ran would prove nothing
+    if (queries == 0) ++failed;
+    PerfResult alone = summarize("gate_under_admin", unloaded, 0);
+    PerfResult result = summarize("gate_under_admin", latencies, failed);
+    if (result.p99_us > alone.p99_us * (1 + PERF_THRESHOLD / 100))
+        ++result.failed;
+    return result;
+}
+
+
+// Multiplier (thousandths) of an hour of the week under PERF_RATES,
+// worked out from the rules by hand
+//==============================================================
+static int64_t perfMultiplier(int weekHour) {
+    int day = weekHour / 24, hour = weekHour % 24;
+    double mult = 1.0;
+    if (day >= 1 && day <= 5 && hour >= 7 && hour < 10) mult *= 1.5;
+    if (day == 6) mult *= 0.8;
+    if (hour >= 22) mult *= 1.25;
+    return llround(mult * MULTIPLIER_SCALE);
+}
+
+
+// Charges of a stay hour by hour, as the tariff reads: the n-th hour
+// of each day of the stay is in the car band of n, a motorcycle pays
+// its daily rate for whole days, & each hour is scaled by the hour of
+// the week it falls in. No prefix sums, no folding of whole weeks
+//==============================================================
+static Money bruteCharges(string vehicleType, time_t dateTimeIn,
+                          int64_t seconds, double occupancy) {
+    if (seconds <= 0) return 0;
+    struct tm tmIn;
+    localtime_r(&dateTimeIn, &tmIn);
+    int weekHour = tmIn.tm_wday * 24 + tmIn.tm_hour;
+    int64_t hours = (seconds + 3599) / 3600, charges = 0, divisor = 1;
+    if (vehicleType.compare("MOTORCYCLE") == 0) {
+        for (int64_t h = 0; h < (hours + 23) / 24 * 24; ++h)
+            charges += MOTO_DAY_RATE *
+                       perfMultiplier((weekHour + h) % HOURS_PER_WEEK);
+        divisor = 24;
+    } else {
+        for (int64_t h = 0; h < hours; ++h)
+            charges += CAR_BAND_RATE[carBandOfHour(h % 24)] *
+                       perfMultiplier((weekHour + h) % HOURS_PER_WEEK);
+    }
+    double percent = occupancy * 100.0;
+    int64_t occMult = percent >= 95.0 ? 1500 : percent >= 80.0 ? 1200
+                                                                : 1000;
+    divisor *= MULTIPLIER_SCALE * MULTIPLIER_SCALE;
+    return (charges * occMult + divisor / 2) / divisor;
+}
+
+
+// Charges of the pricing table against bruteCharges() for stays of up
+// to 30 days per scale starting at any hour, edges of hours, days &
+// weeks, & occupancy on either side of the rules. Only the table is
+// timed, failed counts the charges that differ
+//==============================================================
+static PerfResult perfPricingExact(PerfSetup &setup) {
+    const int64_t edges[8] = { 0, 1, 3600, 3601, 86400, 86401,
+                               7 * 86400, 7 * 86400 + 3600 };
+    vector<double> latencies;
+    int failed = 0;
+    PricingTable pricing;
+    istringstream rates(PERF_RATES);
+    if (!pricing.load(rates)) ++failed;
+    int64_t longest = 30LL * 86400 * setup.scale;
+    for (int i = 0; i < 20000; ++i) {
+        string vehicleType = i % 3 ? "CAR" : "MOTORCYCLE";
+        time_t dateTimeIn = setup.now + i * 1800LL % 604800;
+        int64_t seconds = i % 4 ? i * 7919LL % longest : edges[i / 4 % 8];
+        double occupancy = i % 7 / 6.0 + (i % 5 == 0 ? 0.0 : 0.01);
+        if (i % 11 == 0) occupancy = 0.8;
+        PerfClock::time_point start = PerfClock::now();
+        Money charges = pricing.calcCharges(vehicleType, dateTimeIn,
+                                            seconds, occupancy);
+        latencies.push_back(secondsSince(start));
+        if (charges != bruteCharges(vehicleType, dateTimeIn, seconds,
+                                    occupancy))
+            ++failed;
+    }
+    return summarize("pricing_exact", latencies, failed);
+}
+
+
+// Ledger of 100,000,000 transactions per scale against a reference:
+// the charges of 200,000 stays by the pricing table are each checked
+// against bruteCharges(), then every stay is billed 500 times into a
+// running total that goes through the text of sales.dat every 1,000
+// transactions. The total must equal 500 times the sum of the
+// reference charges to the sen. Each round of 200,000 is timed,
+// failed counts the charges that differ & a total that drifted
+//==============================================================
+static PerfResult perfLedgerExact(PerfSetup &setup) {
+    const int totalStays = 200000, rounds = 500 * setup.scale;
+    vector<double> latencies;
+    int failed = 0;
+    PricingTable pricing;
+    istringstream rates(PERF_RATES);
+    if (!pricing.load(rates)) ++failed;
+    vector<Money> charges(totalStays);
+    Money reference = 0;
+    for (int i = 0; i < totalStays; ++i) {
+        string vehicleType = i % 3 ? "CAR" : "MOTORCYCLE";
+        time_t dateTimeIn = setup.now + i * 60LL % 604800;
+        int64_t seconds = i * 7919LL % 172800;
+        double occupancy = i % 7 / 6.0;
+        charges[i] = pricing.calcCharges(vehicleType, dateTimeIn, seconds,
+                                         occupancy);
+        Money expected = bruteCharges(vehicleType, dateTimeIn, seconds,
+                                      occupancy);
+        if (charges[i] != expected) ++failed;
+        reference += expected;
+    }
+
+    Money total = 0;
+    for (int round = 0; round < rounds; ++round) {
+        PerfClock::time_point start = PerfClock::now();
+        for (int i = 0; i < totalStays; ++i) {
+            total += charges[i];
+            if (i % 1000 == 999 && !parseMoney(formatMoney(total), total))
+                ++failed;
+        }
+        latencies.push_back(secondsSince(start));
+    }
+    if (total != reference * rounds) ++failed;
+    return summarize("ledger_exact", latencies, failed);
+}
+
+
+// Bills of 200,000 stays per scale on the pool like the admin report,
+// each against the sum of one calcCharges() per stay
+//==============================================================
+static PerfResult perfBilling(PerfSetup &setup) {
+    vector<double> latencies;
+    int failed = 0;
+    vector<Stay> stays(200000 * setup.scale);
+    shared_ptr<const PricingTable> pricing = getPricing();
+    Money expected = 0;
+    for (int i = 0; i < (int)stays.size(); ++i) {
+        Stay &stay = stays[i];
+        stay.lot_no = makeLotNo(i % TOTAL_FLOOR, i % TOTAL_LOT_PER_FLOOR + 1);
+        stay.plate_no = setup.plates[i % setup.plates.size()];
+        stay.vehicle_type = i % 3 ? "CAR" : "MOTORCYCLE";
+        stay.date_time_in = setup.now + i * 60LL % 604800;
+        stay.date_time_out = stay.date_time_in + i * 7919LL % 172800;
+        stay.charges = 0;
+        stay.is_parked = false;
+        expected += pricing->calcCharges(stay.vehicle_type,
+                                         stay.date_time_in,
+                                         stay.date_time_out -
+                                         stay.date_time_in, 0.0);
+    }
+    TaskPool pool;
+    for (int round = 0; round < 10; ++round) {
+        PerfClock::time_point start = PerfClock::now();
+        Money billed = billStays(stays, pool);
+        latencies.push_back(secondsSince(start));
+        if (billed != expected) ++failed;
+    }
+    return summarize("billing", latencies, failed);
+}
+
+
+// Whether a backend loaded afresh holds just these vehicles, by plate
+//==============================================================
+static bool isSameStore(string type, string fileName,
+                        const map<string, Transport> &model) {
+    vector<Transport> trans;
+    unique_ptr<Storage> store = makeStorage(type, fileName);
+    if (!store->load(trans) || trans.size() != model.size()) return false;
+    for (int i = 0; i < (int)trans.size(); ++i) {
+        map<string, Transport>::const_iterator it =
+            model.find(trans[i].plate_no);
+        if (it == model.end() ||
+            it->second.lot_no.compare(trans[i].lot_no) != 0 ||
+            it->second.date_time_in != trans[i].date_time_in ||
+            it->second.pin_no.compare(trans[i].pin_no) != 0)
+            return false;
+    }
+    return true;
+}
+
+
+// Park or unpark on a backend as one gate does: load, then change
+//==============================================================
+static bool storeGate(string type, string fileName, const Transport &trans,
+                      bool isPark) {
+    vector<Transport> loaded;
+    unique_ptr<Storage> store = makeStorage(type, fileName);
+    if (!store->load(loaded)) return false;
+    return isPark ? store->append(trans) : store->remove(trans.plate_no);
+}
+
+
+static string readRaw(string fileName) {
+    ifstream rFile(fileName.c_str(), ios::binary);
+    return string(istreambuf_iterator<char>(rFile),
+                  istreambuf_iterator<char>());
+}
+static void writeRaw(string fileName, const string &data) {
+    ofstream wFile(fileName.c_str(), ios::binary | ios::trunc);
+    wFile.write(data.data(), data.size());
+}
+
+
+// The same cases for a backend: an empty store, a plate parked again
+// after an unpark, a plate unparked that was not parked, a rewrite,
+// enough changes for the journal & the key-value engine to compact, a
+// load that leaves the files alone, a damaged text line, & for the
+// binary logs a torn last entry (left out, then cut off by the next
+// append) & damage that fails the load rather than lose what comes
+// after it. How many cases failed
+//==============================================================
+static int checkBackend(string type, string fileName) {
+    int failed = 0;
+    map<string, Transport> model;
+    vector<Transport> trans;
+    Transport first = { "A01", "CONF1", 1000, "pin1" };
+    Transport second = { "A02", "CONF2", 2000, "pin2" };
+    Transport again = { "A03", "CONF1", 3000, "pin3" };
+    Transport missing = { "A04", "CONF4", 4000, "pin4" };
+
+    // A store that is not there yet loads empty & is not made by it
+    unique_ptr<Storage> store = makeStorage(type, fileName);
+    if (!store->load(trans) || !trans.empty() ||
+        stampFile(store->getFileName()).size >= 0)
+        ++failed;
+    string logName = store->getFileName();
+    store.reset();
+
+    storeGate(type, fileName, first, true);
+    storeGate(type, fileName, second, true);
+    model[first.plate_no] = first;
+    model[second.plate_no] = second;
+    if (!isSameStore(type, fileName, model)) ++failed;
+    storeGate(type, fileName, first, false);
+    storeGate(type, fileName, again, true);
+    model[again.plate_no] = again;
+    if (!isSameStore(type, fileName, model)) ++failed;
+    storeGate(type, fileName, missing, false);
+    storeGate(type, fileName, second, false);
+    model.erase(second.plate_no);
+    if (!isSameStore(type, fileName, model)) ++failed;
+
+    store = makeStorage(type, fileName);
+    store->load(trans);
+    trans.assign(1, second);
+    store->rewrite(trans);
+    store.reset();
+    model.clear();
+    model[second.plate_no] = second;
+    if (!isSameStore(type, fileName, model)) ++failed;
+
+    for (int i = 0; i < KV_MEMTABLE_LIMIT * (KV_MAX_SEGMENTS + 1); ++i) {
+        Transport churn = { makeLotNo(i % TOTAL_FLOOR, i % 10 + 1),
+                            "CHURN" + to_string(i % 150), 5000 + i,
+                            "pin" };
+        bool isPark = model.count(churn.plate_no) == 0;
+        storeGate(type, fileName, churn, isPark);
+        if (isPark) model[churn.plate_no] = churn;
+        else model.erase(churn.plate_no);
+    }
+    if (!isSameStore(type, fileName, model)) ++failed;
+    // Loading, readers do it unlocked, never writes
+    string before = readRaw(logName);
+    store = makeStorage(type, fileName);
+    if (!store->load(trans) || readRaw(logName) != before) ++failed;
+    store.reset();
+    if (type.compare(STORAGE_TEXT) == 0) {
+        // A damaged line ahead of the others fails the load
+        writeRaw(logName, "A01 CONF9 notatime pin\n" + before);
+        store = makeStorage(type, fileName);
+        if (store->load(trans)) ++failed;
+        store.reset();
+        writeRaw(logName, before);
+        if (!isSameStore(type, fileName, model)) ++failed;
+        return failed;
+    }
+
+    // A crash partway through an entry
+    string data = readRaw(logName);
+    writeRaw(logName, data + JOURNAL_TORN);
+    if (!isSameStore(type, fileName, model)) ++failed;
+    storeGate(type, fileName, missing, true);
+    model[missing.plate_no] = missing;
+    string repaired = readRaw(logName);
+    if (!isSameStore(type, fileName, model) ||
+        (repaired.size() > data.size() &&
+         repaired.compare(data.size(), JOURNAL_TORN.size(),
+                          JOURNAL_TORN) == 0))
+        ++failed;
+
+    // An unknown entry, a field too long & another magic
+    data = readRaw(logName);
+    ostringstream tooLong;
+    tooLong.put('D');
+    writeBin<uint32_t>(tooLong, 0xFFFFFFFF);
+    tooLong << string(16, 'x');
+    const string damaged[3] = { data + "X" + data.substr(8),
+                                data + tooLong.str(),
+                                "NOTAJNL!" + data.substr(8) };
+    for (int i = 0; i < 3; ++i) {
+        writeRaw(logName, damaged[i]);
+        store = makeStorage(type, fileName);
+        if (store->load(trans) || readRaw(logName) != damaged[i])
+            ++failed;
+        store.reset();
+    }
+    writeRaw(logName, data);
+    if (!isSameStore(type, fileName, model)) ++failed;
+    return failed;
+}
+
+
+static PerfResult perfStorageConformance(PerfSetup &setup) {
+    const string types[3] = { STORAGE_TEXT, STORAGE_JOURNAL, STORAGE_KV };
+    vector<double> latencies;
+    int failed = 0;
+    for (int i = 0; i < 10 * setup.scale; ++i) {
+        for (int t = 0; t < 3; ++t) {
+            string fileName = siteFileName(perfSite(i),
+                                           "conform" + to_string(t) + ".dat");
+            PerfClock::time_point start = PerfClock::now();
+            failed += checkBackend(types[t], fileName);
+            latencies.push_back(secondsSince(start));
+        }
+    }
+    return summarize("storage_conformance", latencies, failed);
+}
+
+
+// Parks & unparks straight on a backend, each loading the store first
+// like a gate, over a garage per scale of plates. Every one is checked
+// against a map that went through the same changes
+//==============================================================
+static PerfResult perfStorage(string name, string type, PerfSetup &setup) {
+    vector<double> latencies;
+    int failed = 0;
+    string fileName = siteFileName(perfSite(0), "store.dat");
+    map<string, Transport> model;
+    int totalPlates = TOTAL_ALL_LOT * setup.scale;
+    for (int i = 0; i < 5000; ++i) {
+        const string &plateNo = setup.plates[i * 7919LL % totalPlates];
+        Transport trans = { makeLotNo(i % TOTAL_FLOOR,
+                                      i / TOTAL_FLOOR % TOTAL_LOT_PER_FLOOR +
+                                      1),
+                            plateNo, setup.now + i, PERF_PIN };
+        bool isPark = model.count(plateNo) == 0;
+        PerfClock::time_point start = PerfClock::now();
+        bool isOk = storeGate(type, fileName, trans, isPark);
+        latencies.push_back(secondsSince(start));
+        if (isPark) model[plateNo] = trans;
+        else model.erase(plateNo);
+        if (!isOk || !isSameStore(type, fileName, model)) ++failed;
+    }
+    return summarize(name, latencies, failed);
+}
+
+static PerfResult perfStorageText(PerfSetup &setup) {
+    return perfStorage("storage_text", STORAGE_TEXT, setup);
+}
+
+static PerfResult perfStorageJournal(PerfSetup &setup) {
+    return perfStorage("storage_journal", STORAGE_JOURNAL, setup);
+}
+
+static PerfResult perfStorageKv(PerfSetup &setup) {
+    return perfStorage("storage_kv", STORAGE_KV, setup);
+}
+
+
+// Fields of audit record n of a perf run: names of every length up to
+// well past what fits a fixed record, & n in the subject to find it by
+//==============================================================
+static void perfAuditFields(int n, string &site, string &subject,
+                            string &lotNo) {
+    site = "SITE" + string(n % 40, 'S');
+    subject = "P" + to_string(n) + "X" + string(n % 50, 'X');
+    lotNo = makeLotNo(n % TOTAL_FLOOR, n % TOTAL_LOT_PER_FLOOR + 1);
+}
+
+
+// Records of an audit file of a perf run that are whole & of a record
+// in [0, total) each: counted into seen, false for any other
+//==============================================================
+static int checkAuditFile(string fileName, vector<int> &seen) {
+    int failed = 0;
+    ifstream auditRF(fileName.c_str(), ios::binary);
+    int version = readAuditVersion(auditRF);
+    if (version != 2) ++failed;
+    AuditRecord rec;
+    string site, subject, lotNo;
+    while (version != 0 && auditRF.peek() != EOF) {
+        if (!readAuditRecord(auditRF, version, rec)) {
+            ++failed;
+            break;
+        }
+        int n = atoi(rec.subject.c_str() + 1);
+        perfAuditFields(n, site, subject, lotNo);
+        if (n < 0 || n >= (int)seen.size() || rec.site != site ||
+            rec.subject != subject || rec.lot_no != lotNo)
+            ++failed;
+        else
+            ++seen[n];
+    }
+    // Every record once, none lost & none twice
+    for (int i = 0; i < (int)seen.size(); ++i)
+        if (seen[i] != 1) ++failed;
+    return failed;
+}
+
+
+// A burst from 4 threads into an audit log of its own, 20,000 records
+// each per scale: many times its ring, so callers wait for the writer.
+// Every record must be read back once & whole, failed counts the ones
+// lost, repeated or cut. Timed is record(), waits included
+//==============================================================
+static PerfResult perfAuditBurst(PerfSetup &setup) {
+    const int totalThreads = 4;
+    int perThread = 20000 * setup.scale;
+    string fileName = siteFileName(perfSite(0), "audit.dat");
+    vector<vector<double> > timings(totalThreads);
+    {
+        unique_ptr<AuditLog> log(new AuditLog(fileName));
+        vector<thread> workers;
+        for (int t = 0; t < totalThreads; ++t) {
+            workers.push_back(thread([&, t]() {
+                string site, subject, lotNo;
+                for (int i = 0; i < perThread; ++i) {
+                    perfAuditFields(t * perThread + i, site, subject, lotNo);
+                    PerfClock::time_point start = PerfClock::now();
+                    log->record(AUDIT_PARK, setup.now + i, site, subject,
+                                lotNo);
+                    timings[t].push_back(secondsSince(start));
+                }
+            }));
+        }
+        for (int t = 0; t < totalThreads; ++t)
+            workers[t].join();
+        log->flush();
+    }
+    vector<double> latencies;
+    for (int t = 0; t < totalThreads; ++t)
+        latencies.insert(latencies.end(), timings[t].begin(),
+                         timings[t].end());
+    vector<int> seen(totalThreads * perThread, 0);
+    int failed = checkAuditFile(fileName, seen);
+    return summarize("audit_burst", latencies, failed);
+}
+
+
+// What a gate pays to audit: records at a pace the writer keeps up
+// with, less than a ring at a time, then checked like audit_burst
+//==============================================================
+static PerfResult perfAuditLatency(PerfSetup &setup) {
+    vector<double> latencies;
+    int total = 50000 * setup.scale;
+    string fileName = siteFileName(perfSite(0), "audit.dat");
+    {
+        unique_ptr<AuditLog> log(new AuditLog(fileName));
+        string site, subject, lotNo;
+        for (int i = 0; i < total; ++i) {
+            perfAuditFields(i, site, subject, lotNo);
+            PerfClock::time_point start = PerfClock::now();
+            log->record(AUDIT_UNPARK, setup.now + i, site, subject, lotNo);
+            latencies.push_back(secondsSince(start));
+            if (i % 1000 == 999) log->flush();
+        }
+    }
+    vector<int> seen(total, 0);
+    int failed = checkAuditFile(fileName, seen);
+    return summarize("audit_latency", latencies, failed);
+}
+
+
+typedef PerfResult (*PerfScenario)(PerfSetup &);
+const PerfScenario PERF_SCENARIOS[] = {
+    perfParkBurst, perfMassUnpark, perfAdminSort, perfLongStay,
+    perfPinHash, perfAdminHash, perfAvailability, perfGateUnderAdmin,
+    perfStorageConformance, perfStorageText, perfStorageJournal,
+    perfStorageKv, perfPricingExact, perfLedgerExact, perfBilling,
+    perfAuditBurst, perfAuditLatency
+};
+const int TOTAL_PERF_SCENARIO = sizeof(PERF_SCENARIOS) /
+                                sizeof(PERF_SCENARIOS[0]);
+
+
+// Each metric is the best of PERF_REPEATS runs, which keeps a noisy
+// machine from failing a check on its own. Every scenario starts with
+// empty scratch sites
+//==============================================================
+bool runPerfScenarios(int scale, vector<PerfResult> &results) {
+    PerfSetup setup;
+    setup.scale = max(1, scale);
+    setup.now = currentTime();
+    results.clear();
+    string fixtureDir = findFixtureDir();
+    if (fixtureDir.empty()) return false;
+    loadPlates(fixtureDir, setup);
+    if (setup.total_fixtures == 0) return false;
+    // Scratch sites are not worth auditing
+    audit.setEnabled(false);
+
+    for (int repeat = 0; repeat < PERF_REPEATS; ++repeat) {
+        for (int i = 0; i < TOTAL_PERF_SCENARIO; ++i) {
+            clearScratchSites();
+            PerfResult run = PERF_SCENARIOS[i](setup);
+            if (repeat == 0) {
+                results.push_back(run);
+                continue;
+            }
+            PerfResult &best = results[i];
+            best.failed = max(best.failed, run.failed);
+            best.ops_per_sec = max(best.ops_per_sec, run.ops_per_sec);
+            best.p50_us = min(best.p50_us, run.p50_us);
+            best.p99_us = min(best.p99_us, run.p99_us);
+        }
+    }
+    clearScratchSites();
+    audit.setEnabled(true);
+    return true;
+}
+
+
+void printPerfResult(ostream &out, const PerfResult &result) {
+    out << "{\"scenario\":" << jsonString(result.name)
+        << ",\"operations\":" << result.operations
+        << ",\"failed\":" << result.failed << fixed << setprecision(2)
+        << ",\"ops_per_sec\":" << result.ops_per_sec
+        << ",\"p50_us\":" << result.p50_us
+        << ",\"p99_us\":" << result.p99_us << '}';
+}
+
+
+bool writePerfBaseline(string fileName, const vector<PerfResult> &results) {
+    string tempName = makeTempName(fileName);
+    ofstream wFile(tempName.c_str());
+    for (int i = 0; i < (int)results.size(); ++i) {
+        printPerfResult(wFile, results[i]);
+        wFile << '\n';
+    }
+    wFile.close();
+    if (wFile.fail() || !replaceFile(tempName, fileName)) {
+        remove(tempName.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// Value of a key in one flat JSON line, without the quotes
+//==============================================================
+static string jsonValue(const string &line, string key) {
+    string::size_type pos = line.find('"' + key + "\":");
+    if (pos == string::npos) return "";
+    pos += key.length() + 3;
+    if (pos < line.length() && line[pos] == '"') {
+        string::size_type end = line.find('"', pos + 1);
+        return end == string::npos ? "" : line.substr(pos + 1, end - pos - 1);
+    }
+    return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+
+bool readPerfBaseline(string fileName, vector<PerfResult> &results) {
+    ifstream rFile(fileName.c_str());
+    if (!rFile.good()) return false;
+    string line;
+    results.clear();
+    while (getline(rFile, line)) {
+        PerfResult result;
+        result.name = jsonValue(line, "scenario");
+        if (result.name.empty()) continue;
+        result.operations = atoi(jsonValue(line, "operations").c_str());
+        result.failed = atoi(jsonValue(line, "failed").c_str());
+        result.ops_per_sec = atof(jsonValue(line, "ops_per_sec").c_str());
+        result.p50_us = atof(jsonValue(line, "p50_us").c_str());
+        result.p99_us = atof(jsonValue(line, "p99_us").c_str());
+        results.push_back(result);
+    }
+    return !results.empty();
+}
+
+
+// Scenarios missing from the baseline are new & pass
+//==============================================================
+vector<string> findRegressions(const vector<PerfResult> &baseline,
+                               const vector<PerfResult> &results,
+                               double threshold) {
+    vector<string> regressions;
+    for (int i = 0; i < (int)results.size(); ++i) {
+        const PerfResult &now = results[i];
+        ostringstream message;
+        message << fixed << setprecision(2);
+        if (now.failed > 0)
+            message << now.name << ": " << now.failed << " failed";
+        for (int j = 0; j < (int)baseline.size(); ++j) {
+            const PerfResult &base = baseline[j];
+            if (base.name.compare(now.name) != 0) continue;
+            if (now.ops_per_sec < base.ops_per_sec * (1 - threshold / 100))
+                message << (message.tellp() > 0 ? ", " : now.name + ": ")
+                        << "ops_per_sec " << now.ops_per_sec << " < "
+                        << base.ops_per_sec;
+            if (now.p99_us > base.p99_us * (1 + threshold / 100))
+                message << (message.tellp() > 0 ? ", " : now.name + ": ")
+                        << "p99_us " << now.p99_us << " > " << base.p99_us;
+        }
+        if (message.tellp() > 0) regressions.push_back(message.str());
+    }
+    return regressions;
+}
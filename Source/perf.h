@@ -0,0 +1,64 @@
+#ifndef PERF_H
+#define PERF_H
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Scenarios run in scratch sites (perf0, perf1 ..) on the vehicles of
+// the fixtures in PERF_FIXTURE_DIR, topped up with made up plates
+const std::string PERF_SITE = "perf";
+const std::string PERF_FIXTURE_DIR = "MockData";
+const std::string PERF_BASELINE_FILE = "perf.json";
+// Slower by more than this percent (throughput or p99) is a regression
+const double PERF_THRESHOLD = 25.0;
+
+// Best of a few runs of one scenario
+struct PerfResult {
+    std::string name;
+    int operations;
+    int failed;
+    double ops_per_sec;
+    double p50_us;
+    double p99_us;
+};
+
+// Run every scenario, false if the fixtures are missing. The scale
+// multiplies the data, not the repetitions:
+//   park_burst    parks into garages kept 90% full (genLotNo), one
+//                 garage per scale
+//   mass_unpark   unparks full garages (file rewrites)
+//   admin_sort    reads, sorts & searches every full garage
+//   long_stay     charges of stays of up to 90 days per scale
+//   pin_hash      hashes & checks of PINs (every park & unpark)
+//   admin_hash    hashes & checks of the stretched admin password
+//   availability  free lot searches among 100,000 bookings per scale
+//   gate_under_admin  parks & unparks (p99), every other round while
+//                 another thread reads, sorts & searches the garages,
+//                 failed if slower with it by more than PERF_THRESHOLD
+//   storage_conformance  the same edge cases (crashes & damage too) on
+//                 every storage backend, failed counts the cases
+//   storage_text, storage_journal, storage_kv  parks & unparks of a
+//                 garage per scale on each backend, each checked
+//   pricing_exact  charges of a pricing table against a charge worked
+//                 out hour by hour, stays of up to 30 days per scale
+//   ledger_exact  100,000,000 charges per scale added up like the sales
+//                 file, the total against hour by hour charges of
+//                 200,000 stays (failed counts charges & totals off)
+//   billing       bills of 200,000 stays per scale on the task pool
+//   audit_burst   records from 4 threads, many rings full, each read
+//                 back whole & once (failed counts lost ones)
+//   audit_latency records at a pace the audit writer keeps up with
+bool runPerfScenarios(int, std::vector<PerfResult> &);
+// Where the fixtures were found, empty if nowhere
+std::string findFixtureDir();
+// A baseline is one JSON line per scenario
+bool writePerfBaseline(std::string, const std::vector<PerfResult> &);
+bool readPerfBaseline(std::string, std::vector<PerfResult> &);
+// One message per scenario that regressed from the baseline by more
+// than the threshold (percent)
+std::vector<std::string> findRegressions(const std::vector<PerfResult> &,
+                                         const std::vector<PerfResult> &,
+                                         double);
+void printPerfResult(std::ostream &, const PerfResult &);
+
+#endif
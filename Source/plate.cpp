@@ -0,0 +1,121 @@
+#include <algorithm>     // min, sort, unique
+#include "plate.h"
+using namespace std;
+
+
+//==============================================================
+string canonicalPlate(string plate) {
+    for (string::size_type i = 0; i < plate.length(); ++i) {
+        switch (plate[i]) {
+            case 'O': case 'Q': case 'D': plate[i] = '0'; break;
+            case 'I': case 'L': plate[i] = '1'; break;
+            case 'Z': plate[i] = '2'; break;
+            case 'S': plate[i] = '5'; break;
+            case 'G': plate[i] = '6'; break;
+            case 'B': plate[i] = '8'; break;
+        }
+    }
+    return plate;
+}
+
+
+// Plates are short, two rows of the table are enough
+//==============================================================
+int plateDistance(const string &a, const string &b) {
+    vector<int> prev(b.length() + 1), curr(b.length() + 1);
+    for (int j = 0; j <= (int)b.length(); ++j)
+        prev[j] = j;
+    for (int i = 1; i <= (int)a.length(); ++i) {
+        curr[0] = i;
+        for (int j = 1; j <= (int)b.length(); ++j)
+            curr[j] = min(min(prev[j] + 1, curr[j - 1] + 1),
+                          prev[j - 1] + (a[i - 1] != b[j - 1]));
+        prev.swap(curr);
+    }
+    return prev[b.length()];
+}
+
+
+// Every string left after deleting up to some characters, with repeats
+//==============================================================
+void PlateIndex::deletions(const string &plate, int edits,
+                           vector<string> &result) {
+    result.push_back(plate);
+    if (edits == 0) return;
+    for (string::size_type i = 0; i < plate.length(); ++i) {
+        // Further deletions only after i, each set of positions once
+        vector<string> more;
+        deletions(plate.substr(i + 1), edits - 1, more);
+        for (int j = 0; j < (int)more.size(); ++j)
+            result.push_back(plate.substr(0, i) + more[j]);
+    }
+}
+
+
+// Plates that read the same share one entry
+//==============================================================
+void PlateIndex::add(string plate) {
+    string canonical = canonicalPlate(plate);
+    unordered_map<string, int>::iterator found =
+        this->by_canonical.find(canonical);
+    if (found != this->by_canonical.end()) {
+        this->entries[found->second].plates.push_back(plate);
+        return;
+    }
+
+    int id = this->entries.size();
+    Entry newEntry;
+    newEntry.canonical = canonical;
+    newEntry.plates.push_back(plate);
+    this->entries.push_back(newEntry);
+    this->by_canonical[canonical] = id;
+
+    vector<string> keys;
+    deletions(canonical, PLATE_MAX_EDITS, keys);
+    for (int i = 0; i < (int)keys.size(); ++i) {
+        vector<int> &ids = this->by_deletion[keys[i]];
+        if (ids.empty() || ids.back() != id) ids.push_back(id);
+    }
+}
+
+
+//==============================================================
+vector<string> PlateIndex::search(string plate, int maxEdits) {
+    vector<pair<int, string> > found;
+    vector<int> seen;
+    string canonical = canonicalPlate(plate);
+    maxEdits = min(maxEdits, PLATE_MAX_EDITS);
+
+    vector<string> keys;
+    deletions(canonical, maxEdits, keys);
+    for (int i = 0; i < (int)keys.size(); ++i) {
+        unordered_map<string, vector<int> >::iterator ids =
+            this->by_deletion.find(keys[i]);
+        if (ids == this->by_deletion.end()) continue;
+        seen.insert(seen.end(), ids->second.begin(), ids->second.end());
+    }
+    sort(seen.begin(), seen.end());
+    seen.erase(unique(seen.begin(), seen.end()), seen.end());
+
+    for (int i = 0; i < (int)seen.size(); ++i) {
+        Entry &entry = this->entries[seen[i]];
+        int dist = plateDistance(canonical, entry.canonical);
+        if (dist > maxEdits) continue;
+        for (int j = 0; j < (int)entry.plates.size(); ++j)
+            found.push_back(make_pair(dist, entry.plates[j]));
+    }
+
+    sort(found.begin(), found.end());
+    vector<string> result;
+    for (int i = 0; i < (int)found.size(); ++i)
+        result.push_back(found[i].second);
+    return result;
+}
+
+
+int PlateIndex::getTotalPlates() {
+    int total = 0;
+    for (int i = 0; i < (int)this->entries.size(); ++i)
+        total += this->entries[i].plates.size();
+    return total;
+}
@@ -0,0 +1,41 @@
+#ifndef PLATE_H
+#define PLATE_H
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Edits allowed between a camera read & a parked plate
+const int PLATE_MAX_EDITS = 2;
+
+// Plate with characters cameras mix up made the same:
+// O Q D -> 0, I L -> 1, Z -> 2, S -> 5, G -> 6, B -> 8
+std::string canonicalPlate(std::string);
+// Levenshtein distance between two plates
+int plateDistance(const std::string &, const std::string &);
+
+// Symmetric deletion index of canonical plates: every plate is filed
+// under each string left after deleting up to PLATE_MAX_EDITS of its
+// characters. Two plates within that many edits always share one of
+// these strings, so a search looks up the read's own deletions and
+// only measures the distance to the few plates found there
+class PlateIndex
+{
+    public:
+        void add(std::string);
+        // Plates within some edits (up to PLATE_MAX_EDITS) of a read,
+        // nearest first
+        std::vector<std::string> search(std::string, int);
+        int getTotalPlates();
+    private:
+        static void deletions(const std::string &, int,
+                              std::vector<std::string> &);
+        struct Entry {
+            std::string canonical;
+            std::vector<std::string> plates;
+        };
+        std::vector<Entry> entries;
+        std::unordered_map<std::string, int> by_canonical;
+        std::unordered_map<std::string, std::vector<int> > by_deletion;
+};
+
+#endif
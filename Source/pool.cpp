@@ -0,0 +1,117 @@
+#include <algorithm>     // max
+#include "pool.h"
+using namespace std;
+
+
+//  Constructor: start the workers, they sleep until tasks come
+//==============================================================
+TaskPool::TaskPool(int totalThreads) : total_queued(0), total_pending(0),
+                                       total_run(0), total_stolen(0),
+                                       stopping(false) {
+    if (totalThreads <= 0)
+        totalThreads = max(1u, thread::hardware_concurrency());
+    for (int i = 0; i < totalThreads; ++i)
+        this->workers.push_back(unique_ptr<Worker>(new Worker));
+    for (int i = 0; i < totalThreads; ++i)
+        this->threads.push_back(thread(&TaskPool::run, this, i));
+}
+
+
+int TaskPool::getTotalThreads() {
+    return this->workers.size();
+}
+
+
+// Shards wrap around the workers, e.g. floor J of 4 workers goes to
+// worker 1
+//==============================================================
+void TaskPool::submit(int shard, function<void()> task) {
+    Worker &worker = *this->workers[(unsigned)shard % this->workers.size()];
+    {
+        lock_guard<mutex> guard(worker.lock);
+        worker.tasks.push_back(task);
+    }
+    this->total_pending.fetch_add(1);
+    this->total_queued.fetch_add(1);
+    // Taking the lock makes sure a worker about to sleep sees the task
+    lock_guard<mutex> guard(this->idle_lock);
+    this->has_work.notify_one();
+}
+
+
+void TaskPool::wait() {
+    unique_lock<mutex> guard(this->idle_lock);
+    this->all_done.wait(guard, [this] {
+        return this->total_pending.load() == 0;
+    });
+}
+
+
+uint64_t TaskPool::getTotalRun() {
+    return this->total_run.load();
+}
+
+
+uint64_t TaskPool::getTotalStolen() {
+    return this->total_stolen.load();
+}
+
+
+// Newest task of its own first (still warm in the cache), else the
+// oldest task of the next worker that has one
+//==============================================================
+bool TaskPool::takeTask(int self, function<void()> &task) {
+    int total = this->workers.size();
+    for (int i = 0; i < total; ++i) {
+        Worker &worker = *this->workers[(self + i) % total];
+        lock_guard<mutex> guard(worker.lock);
+        if (worker.tasks.empty()) continue;
+        if (i == 0) {
+            task = worker.tasks.back();
+            worker.tasks.pop_back();
+        } else {
+            task = worker.tasks.front();
+            worker.tasks.pop_front();
+            this->total_stolen.fetch_add(1);
+        }
+        this->total_queued.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+
+void TaskPool::run(int self) {
+    function<void()> task;
+    while (true) {
+        if (this->takeTask(self, task)) {
+            task();
+            task = nullptr;
+            this->total_run.fetch_add(1);
+            if (this->total_pending.fetch_sub(1) == 1) {
+                lock_guard<mutex> guard(this->idle_lock);
+                this->all_done.notify_all();
+            }
+            continue;
+        }
+        unique_lock<mutex> guard(this->idle_lock);
+        this->has_work.wait(guard, [this] {
+            return this->stopping || this->total_queued.load() > 0;
+        });
+        if (this->stopping && this->total_queued.load() == 0) return;
+    }
+}
+
+
+//  Destructor: finish every task, then stop the workers
+//==============================================================
+TaskPool::~TaskPool() {
+    this->wait();
+    {
+        lock_guard<mutex> guard(this->idle_lock);
+        this->stopping = true;
+        this->has_work.notify_all();
+    }
+    for (int i = 0; i < (int)this->threads.size(); ++i)
+        this->threads[i].join();
+}
@@ -0,0 +1,50 @@
+#ifndef POOL_H
+#define POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own deque of tasks. A
+// task goes to the deque of the shard it belongs to (e.g. a floor),
+// its worker takes the newest task first & an idle worker steals the
+// oldest task of another, so one busy floor does not hold up the rest
+class TaskPool
+{
+    public:
+        // 0 threads means one per core
+        explicit TaskPool(int = 0);
+        int getTotalThreads();
+        // Queue a task on the worker of a shard
+        void submit(int, std::function<void()>);
+        // Wait until every task submitted so far has run
+        void wait();
+        // Tasks run & tasks taken from another worker so far
+        uint64_t getTotalRun();
+        uint64_t getTotalStolen();
+        ~TaskPool();
+    private:
+        struct Worker {
+            std::mutex lock;
+            std::deque<std::function<void()> > tasks;
+        };
+        void run(int);
+        bool takeTask(int, std::function<void()> &);
+        std::vector<std::unique_ptr<Worker> > workers;
+        std::vector<std::thread> threads;
+        std::mutex idle_lock;
+        std::condition_variable has_work;
+        std::condition_variable all_done;
+        std::atomic<uint64_t> total_queued;
+        std::atomic<uint64_t> total_pending;
+        std::atomic<uint64_t> total_run;
+        std::atomic<uint64_t> total_stolen;
+        bool stopping;
+};
+
+#endif
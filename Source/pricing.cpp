@@ -0,0 +1,171 @@
+#include <algorithm>     // sort
+#include <cmath>         // llround
+#include <fstream>       // ifstream
+#include <mutex>         // mutex
+#include <sstream>       // istringstream
+#include "aps.h"
+#include "pricing.h"
+using namespace std;
+
+
+//  Constructor: no rules, every multiplier is 1
+//==============================================================
+PricingTable::PricingTable() {
+    this->prefix[0] = 0;
+    for (int h = 0; h < HOURS_PER_WEEK; ++h) {
+        this->multiplier[h] = MULTIPLIER_SCALE;
+        this->prefix[h + 1] = this->prefix[h] + MULTIPLIER_SCALE;
+    }
+}
+
+
+// Compile the rules, the table is unchanged if any line is invalid
+//==============================================================
+bool PricingTable::load(istream &in) {
+    const string days[7] = { "SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT" };
+    double newMultiplier[HOURS_PER_WEEK];
+    vector<pair<double, int64_t> > newOccupancy;
+    for (int h = 0; h < HOURS_PER_WEEK; ++h)
+        newMultiplier[h] = 1.0;
+
+    string line, kind, day;
+    while (getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        if (!(ss >> kind)) continue;
+        double mult, percent;
+        int from, to;
+        if (kind.compare("TIME") == 0) {
+            if (!(ss >> day >> from >> to >> mult) ||
+                from < 0 || to > 24 || from >= to || mult < 0.0)
+                return false;
+            bool isMatched = false;
+            for (int d = 0; d < 7; ++d) {
+                bool isWeekend = d == 0 || d == 6;
+                if (day.compare("ALL") == 0 || day.compare(days[d]) == 0 ||
+                    (day.compare("WEEKEND") == 0 && isWeekend) ||
+                    (day.compare("WEEKDAY") == 0 && !isWeekend)) {
+                    for (int h = from; h < to; ++h)
+                        newMultiplier[d * 24 + h] *= mult;
+                    isMatched = true;
+                }
+            }
+            if (!isMatched) return false;
+        } else if (kind.compare("OCCUPANCY") == 0) {
+            if (!(ss >> percent >> mult) || percent < 0.0 || mult < 0.0)
+                return false;
+            newOccupancy.push_back(make_pair(percent,
+                (int64_t)llround(mult * MULTIPLIER_SCALE)));
+        } else {
+            return false;
+        }
+    }
+
+    sort(newOccupancy.begin(), newOccupancy.end());
+    this->occupancy_rules.swap(newOccupancy);
+    for (int h = 0; h < HOURS_PER_WEEK; ++h) {
+        this->multiplier[h] = llround(newMultiplier[h] * MULTIPLIER_SCALE);
+        this->prefix[h + 1] = this->prefix[h] + this->multiplier[h];
+    }
+    return true;
+}
+
+
+// Sum of the multipliers of hours [start, start + hours) of the week,
+// wrapping around the end of the week
+//==============================================================
+int64_t PricingTable::sumMultiplier(int start, int64_t hours) const {
+    int64_t total = (hours / HOURS_PER_WEEK) * this->prefix[HOURS_PER_WEEK];
+    int rest = hours % HOURS_PER_WEEK;
+    if (start + rest <= HOURS_PER_WEEK)
+        return total + this->prefix[start + rest] - this->prefix[start];
+    return total + this->prefix[HOURS_PER_WEEK] - this->prefix[start]
+                 + this->prefix[start + rest - HOURS_PER_WEEK];
+}
+
+
+// Same rates as the fixed tariff, each charged hour (or day) is scaled
+// by the multiplier of the hour of the week it starts in. Everything is
+// summed in sen x multiplier scale & rounded to the sen once
+//==============================================================
+Money PricingTable::calcCharges(string vehicleType, time_t dateTimeIn,
+                                int64_t seconds, double occupancy) const {
+    if (seconds <= 0) return 0;
+    struct tm tmIn;
+    localtime_r(&dateTimeIn, &tmIn);
+    int weekHour = tmIn.tm_wday * 24 + tmIn.tm_hour;
+    int64_t hours = (seconds + 3599) / 3600;
+    int64_t charges = 0, divisor = 1;
+
+    if (vehicleType.compare("MOTORCYCLE") == 0) {
+        // Daily rate spread evenly over the 24 hours of each day
+        int64_t days = (hours + 23) / 24;
+        charges = MOTO_DAY_RATE * sumMultiplier(weekHour, days * 24);
+        divisor = 24;
+    } else if (vehicleType.compare("CAR") == 0) {
+        // Bands repeat every day & multipliers every week, so a whole
+        // week of the stay costs the same wherever it falls
+        int64_t weeks = hours / HOURS_PER_WEEK;
+        int64_t rest = hours % HOURS_PER_WEEK;
+        int64_t weekCharges = 0;
+        for (int day = 0; day < 7; ++day) {
+            int start = 0;
+            for (int b = 0; b < TOTAL_CAR_BAND; ++b) {
+                int first = day * 24 + start,
+                    width = CAR_BAND_END[b] - start;
+                int hour = (weekHour + first) % HOURS_PER_WEEK;
+                weekCharges += sumMultiplier(hour, width) * CAR_BAND_RATE[b];
+                // The last, partial week only counts hours before rest
+                if (first < rest) {
+                    int64_t inRest = min((int64_t)width, rest - first);
+                    charges += sumMultiplier(hour, inRest) * CAR_BAND_RATE[b];
+                }
+                start = CAR_BAND_END[b];
+            }
+        }
+        charges += weeks * weekCharges;
+    }
+
+    // Whole stay scaled by how full the garage is
+    double percent = occupancy * 100.0;
+    int64_t occMult = MULTIPLIER_SCALE;
+    for (int i = 0; i < (int)this->occupancy_rules.size(); ++i)
+        if (this->occupancy_rules[i].first <= percent)
+            occMult = this->occupancy_rules[i].second;
+    // Round to the nearest sen
+    divisor *= MULTIPLIER_SCALE * MULTIPLIER_SCALE;
+    return (charges * occMult + divisor / 2) / divisor;
+}
+
+
+//==============================================================
+
+
+std::shared_ptr<const PricingTable> getPricing() {
+    bool isValid;
+    return getPricing(isValid);
+}
+std::shared_ptr<const PricingTable> getPricing(bool &isValid) {
+    static mutex lock;
+    static shared_ptr<const PricingTable> current(new PricingTable());
+    static FileStamp loadedStamp;
+    static bool isLoaded = false, isRejected = false;
+
+    lock_guard<mutex> guard(lock);
+    // Size, inode & mtime to the ns: a change in the same second as
+    // the last load is still seen
+    FileStamp stamp = stampFile(RATES_FILE);
+    bool isFound = stamp.size >= 0;
+    if (!isLoaded || !isSameStamp(stamp, loadedStamp)) {
+        // File changed (or went away): compile the new rules, keeping
+        // the old table if they do not parse
+        shared_ptr<PricingTable> table(new PricingTable());
+        ifstream ratesRF(RATES_FILE.c_str());
+        isRejected = isFound && !table->load(ratesRF);
+        if (!isRejected) current = table;
+        loadedStamp = stamp;
+        isLoaded = true;
+    }
+    isValid = !isRejected;
+    return current;
+}
@@ -0,0 +1,49 @@
+#ifndef PRICING_H
+#define PRICING_H
+#include <cstdint>
+#include <ctime>
+#include <istream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "money.h"
+
+const std::string RATES_FILE = "rates.dat";
+const int HOURS_PER_WEEK = 7 * 24;
+// Multipliers are kept in thousandths so charges stay in whole numbers
+const int64_t MULTIPLIER_SCALE = 1000;
+
+// Pricing rules compiled into an hourly rate multiplier for every hour
+// of the week plus its prefix sums, so billing a stay of any length
+// takes a fixed number of lookups instead of a loop over its hours.
+//
+// Rules in rates.dat, one per line ('#' starts a comment):
+//   TIME <day> <from hour> <to hour> <multiplier>
+//       day is SUN..SAT, WEEKDAY, WEEKEND or ALL, hours are 0-24
+//   OCCUPANCY <percent> <multiplier>
+//       applied to the whole stay when the garage is at least this full
+// Multipliers of overlapping TIME rules are multiplied together.
+class PricingTable
+{
+    public:
+        PricingTable();
+        bool load(std::istream &);
+        // Charges for a stay of some seconds, occupancy is 0.0 - 1.0
+        // at exit time
+        Money calcCharges(std::string, time_t, int64_t, double) const;
+    private:
+        int64_t sumMultiplier(int, int64_t) const;
+        int64_t multiplier[HOURS_PER_WEEK];
+        int64_t prefix[HOURS_PER_WEEK + 1];
+        // (percent, multiplier) sorted by percent
+        std::vector<std::pair<double, int64_t> > occupancy_rules;
+};
+
+// Rules from RATES_FILE, reloaded whenever the file changes. A file
+// that does not parse is rejected (isValid false) & the rules in use
+// before it are kept
+std::shared_ptr<const PricingTable> getPricing();
+std::shared_ptr<const PricingTable> getPricing(bool &isValid);
+
+#endif
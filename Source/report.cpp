@@ -0,0 +1,243 @@
+#include <algorithm>     // min, max, partial_sort
+#include <ctime>         // localtime_r
+#include <functional>    // bind
+#include "pricing.h"
+#include "report.h"
+using namespace std;
+
+const u32 MIN_STAY_PER_TASK = 20000;
+
+// Stays [first, last) of the stays of a floor, one task each
+struct StayChunk {
+    int shard;
+    u32 first;
+    u32 last;
+};
+
+
+// Longest stay first
+//==============================================================
+static bool isLongerStay(const Stay &s1, const Stay &s2) {
+    return s1.date_time_out - s1.date_time_in >
+           s2.date_time_out - s2.date_time_in;
+}
+
+
+// Keep only the TOTAL_TOP_STAY longest stays, longest first
+//==============================================================
+static void trimTopStays(vector<Stay> &stays) {
+    int n = min((int)stays.size(), TOTAL_TOP_STAY);
+    partial_sort(stays.begin(), stays.begin() + n, stays.end(), isLongerStay);
+    stays.resize(n);
+}
+
+
+static void clearReport(Report &rep) {
+    for (int d = 0; d < 7; ++d)
+        for (int h = 0; h < 24; ++h)
+            rep.occupancy[d][h] = 0;
+    for (int f = 0; f < TOTAL_FLOOR; ++f) {
+        rep.dwell_sum[f] = 0;
+        rep.dwell_count[f] = 0;
+    }
+    for (int b = 0; b < TOTAL_CAR_BAND; ++b) {
+        rep.band_hours[b] = 0;
+        rep.band_revenue[b] = 0;
+    }
+    rep.moto_days = 0;
+    rep.moto_revenue = 0;
+    rep.car_charged = 0;
+    rep.moto_charged = 0;
+    rep.top_stays.clear();
+}
+
+
+// Floor A-J of a stay, -1 if its lot is not on a floor
+//==============================================================
+static int floorOfStay(const Stay &stay) {
+    int floor = stay.lot_no.empty() ? -1 : stay.lot_no[0] - 'A';
+    return floor >= 0 && floor < TOTAL_FLOOR ? floor : -1;
+}
+
+
+// Add the stays picked by [first, last) of picks to rep, each task
+// runs this on its chunk of a floor
+//==============================================================
+static void addStays(const vector<Stay> *stays, const vector<u32> *picks,
+                     u32 first, u32 last, Report *rep) {
+    struct tm tmIn;
+    for (u32 i = first; i < last; ++i) {
+        const Stay &stay = (*stays)[(*picks)[i]];
+        long seconds = max(0L, (long)(stay.date_time_out - stay.date_time_in));
+        // Hours charged are the hours started, like calcCharges()
+        long hours = (seconds + 3599) / 3600;
+
+        // Occupancy: whole weeks fill every cell, then walk the rest
+        long weeks = hours / HOURS_PER_WEEK;
+        if (weeks > 0)
+            for (int d = 0; d < 7; ++d)
+                for (int h = 0; h < 24; ++h)
+                    rep->occupancy[d][h] += weeks;
+        localtime_r(&stay.date_time_in, &tmIn);
+        int day = tmIn.tm_wday, hour = tmIn.tm_hour;
+        for (long h = 0; h < hours % HOURS_PER_WEEK; ++h) {
+            ++rep->occupancy[day][hour];
+            if (++hour == 24) {
+                hour = 0;
+                day = (day + 1) % 7;
+            }
+        }
+
+        // Dwell time by floor A-J
+        int floor = floorOfStay(stay);
+        if (floor >= 0) {
+            rep->dwell_sum[floor] += seconds;
+            ++rep->dwell_count[floor];
+        }
+
+        // Revenue by band, only for stays that were paid
+        if (!stay.is_parked && stay.vehicle_type.compare("CAR") == 0) {
+            rep->car_charged += stay.charges;
+            long days = hours / 24, rest = hours % 24;
+            int start = 0;
+            for (int b = 0; b < TOTAL_CAR_BAND; ++b) {
+                int width = CAR_BAND_END[b] - start;
+                long inBand = days * width +
+                              min((long)width, max(0L, rest - start));
+                rep->band_hours[b] += inBand;
+                rep->band_revenue[b] += inBand * CAR_BAND_RATE[b];
+                start = CAR_BAND_END[b];
+            }
+        } else if (!stay.is_parked &&
+                   stay.vehicle_type.compare("MOTORCYCLE") == 0) {
+            long days = (hours + 23) / 24;
+            rep->moto_charged += stay.charges;
+            rep->moto_days += days;
+            rep->moto_revenue += days * MOTO_DAY_RATE;
+        }
+
+        // Longest stays, trimmed now & then to keep the list short
+        rep->top_stays.push_back(stay);
+        if ((int)rep->top_stays.size() >= 8 * TOTAL_TOP_STAY)
+            trimTopStays(rep->top_stays);
+    }
+    trimTopStays(rep->top_stays);
+}
+
+
+static void mergeReport(Report &rep, const Report &part) {
+    for (int d = 0; d < 7; ++d)
+        for (int h = 0; h < 24; ++h)
+            rep.occupancy[d][h] += part.occupancy[d][h];
+    for (int f = 0; f < TOTAL_FLOOR; ++f) {
+        rep.dwell_sum[f] += part.dwell_sum[f];
+        rep.dwell_count[f] += part.dwell_count[f];
+    }
+    for (int b = 0; b < TOTAL_CAR_BAND; ++b) {
+        rep.band_hours[b] += part.band_hours[b];
+        rep.band_revenue[b] += part.band_revenue[b];
+    }
+    rep.moto_days += part.moto_days;
+    rep.moto_revenue += part.moto_revenue;
+    rep.car_charged += part.car_charged;
+    rep.moto_charged += part.moto_charged;
+    rep.top_stays.insert(rep.top_stays.end(),
+                         part.top_stays.begin(), part.top_stays.end());
+    trimTopStays(rep.top_stays);
+}
+
+
+// Stays of each floor (the stays of no floor after floor J) & the
+// chunks of MIN_STAY_PER_TASK they are split into, floor by floor
+//==============================================================
+static void shardByFloor(const vector<Stay> &stays,
+                         vector<vector<u32> > &shards,
+                         vector<StayChunk> &chunks) {
+    shards.assign(TOTAL_FLOOR + 1, vector<u32>());
+    for (u32 i = 0; i < (u32)stays.size(); ++i) {
+        int floor = floorOfStay(stays[i]);
+        shards[floor < 0 ? TOTAL_FLOOR : floor].push_back(i);
+    }
+    chunks.clear();
+    for (int s = 0; s <= TOTAL_FLOOR; ++s) {
+        u32 total = shards[s].size();
+        for (u32 first = 0; first < total; first += MIN_STAY_PER_TASK) {
+            StayChunk chunk;
+            chunk.shard = s;
+            chunk.first = first;
+            chunk.last = min(total, first + MIN_STAY_PER_TASK);
+            chunks.push_back(chunk);
+        }
+    }
+}
+
+
+// Each chunk is a task on the worker of its floor, few stays are not
+// worth waking the workers for
+//==============================================================
+Report buildReport(const vector<Stay> &stays, TaskPool &pool) {
+    vector<vector<u32> > shards;
+    vector<StayChunk> chunks;
+    shardByFloor(stays, shards, chunks);
+    bool isInline = stays.size() < MIN_STAY_PER_TASK;
+
+    vector<Report> parts(chunks.size());
+    for (int i = 0; i < (int)chunks.size(); ++i) {
+        const StayChunk &chunk = chunks[i];
+        clearReport(parts[i]);
+        if (isInline)
+            addStays(&stays, &shards[chunk.shard], chunk.first, chunk.last,
+                     &parts[i]);
+        else
+            pool.submit(chunk.shard, bind(addStays, &stays,
+                                          &shards[chunk.shard], chunk.first,
+                                          chunk.last, &parts[i]));
+    }
+    if (!isInline) pool.wait();
+
+    // Merged in order, so the report does not depend on the workers
+    Report rep;
+    clearReport(rep);
+    for (int i = 0; i < (int)parts.size(); ++i)
+        mergeReport(rep, parts[i]);
+    return rep;
+}
+
+
+// Charges of one chunk of a floor through the pricing table
+//==============================================================
+static void billChunk(const vector<Stay> *stays, const vector<u32> *picks,
+                      u32 first, u32 last, const PricingTable *pricing,
+                      Money *billed) {
+    for (u32 i = first; i < last; ++i) {
+        const Stay &stay = (*stays)[(*picks)[i]];
+        *billed += pricing->calcCharges(stay.vehicle_type, stay.date_time_in,
+            max((int64_t)0, (int64_t)(stay.date_time_out -
+                                      stay.date_time_in)), 0.0);
+    }
+}
+
+
+// Same chunks & workers as buildReport(), the occupancy of the site at
+// the time is not known so no OCCUPANCY rule applies
+//==============================================================
+Money billStays(const vector<Stay> &stays, TaskPool &pool) {
+    vector<vector<u32> > shards;
+    vector<StayChunk> chunks;
+    shardByFloor(stays, shards, chunks);
+    shared_ptr<const PricingTable> pricing = getPricing();
+
+    vector<Money> parts(chunks.size(), 0);
+    for (int i = 0; i < (int)chunks.size(); ++i) {
+        const StayChunk &chunk = chunks[i];
+        pool.submit(chunk.shard, bind(billChunk, &stays, &shards[chunk.shard],
+                                      chunk.first, chunk.last,
+                                      pricing.get(), &parts[i]));
+    }
+    pool.wait();
+
+    Money billed = 0;
+    for (int i = 0; i < (int)parts.size(); ++i)
+        billed += parts[i];
+    return billed;
+}
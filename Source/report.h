@@ -0,0 +1,37 @@
+#ifndef REPORT_H
+#define REPORT_H
+#include <vector>
+#include "aps.h"
+#include "pool.h"
+
+const int TOTAL_TOP_STAY = 10;
+
+// Admin analytics over finished & current stays
+struct Report {
+    // Vehicle-hours parked by day of week (0 = Sunday) & hour of day
+    u32 occupancy[7][24];
+    // Sum & number of stays (in seconds) by floor
+    int64_t dwell_sum[TOTAL_FLOOR];
+    u32 dwell_count[TOTAL_FLOOR];
+    // Charged car hours by tariff band & their nominal revenue at the
+    // band rates, before any pricing rule
+    int64_t band_hours[TOTAL_CAR_BAND];
+    Money band_revenue[TOTAL_CAR_BAND];
+    // Charged motorcycle days & their nominal revenue
+    int64_t moto_days;
+    Money moto_revenue;
+    // What was actually billed (Stay::charges) for cars & motorcycles
+    Money car_charged;
+    Money moto_charged;
+    // Longest stays, longest first
+    std::vector<Stay> top_stays;
+};
+
+// Build the report on the pool for large numbers of stays, the stays
+// of each floor are a shard of their own
+Report buildReport(const std::vector<Stay> &, TaskPool &);
+// Charges of every stay as if it were paid on leaving, by floor on the
+// pool like buildReport()
+Money billStays(const std::vector<Stay> &, TaskPool &);
+
+#endif
@@ -0,0 +1,184 @@
+#include <cstdint>       // uint64_t
+#include <cstdlib>       // getenv
+#include <fstream>       // ifstream
+#include <mutex>         // call_once
+#include <random>        // random_device
+#include <sstream>       // stringstream
+#include <iomanip>       // setw, setfill
+#include <fcntl.h>       // open
+#include <unistd.h>      // write, close
+#include "secret.h"
+using namespace std;
+
+typedef uint64_t u64;
+
+
+// SipHash-2-4 keyed by (k0, k1), cheap enough for every unpark
+//==============================================================
+static inline u64 rotl(u64 x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+static inline void sipRound(u64 &v0, u64 &v1, u64 &v2, u64 &v3) {
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+}
+static u64 sipHash(u64 k0, u64 k1, const string &data) {
+    u64 v0 = k0 ^ 0x736f6d6570736575ULL,
+        v1 = k1 ^ 0x646f72616e646f6dULL,
+        v2 = k0 ^ 0x6c7967656e657261ULL,
+        v3 = k1 ^ 0x7465646279746573ULL;
+    string::size_type len = data.length(), i, j;
+    u64 m;
+    // Compress every full 8 byte block
+    for (i = 0; i + 8 <= len; i += 8) {
+        m = 0;
+        for (j = 0; j < 8; ++j)
+            m |= (u64)(unsigned char)data[i + j] << (8 * j);
+        v3 ^= m;
+        sipRound(v0, v1, v2, v3);
+        sipRound(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    // Last block holds the remaining bytes and the length
+    m = (u64)(len & 0xff) << 56;
+    for (j = 0; i + j < len; ++j)
+        m |= (u64)(unsigned char)data[i + j] << (8 * j);
+    v3 ^= m;
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    v0 ^= m;
+    // Finalization
+    v2 ^= 0xff;
+    for (j = 0; j < 4; ++j)
+        sipRound(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+// Hex helpers for storing salt & hash as one text field
+//==============================================================
+static string toHex(u64 x) {
+    stringstream ss;
+    ss << hex << setw(16) << setfill('0') << x;
+    return ss.str();
+}
+static bool fromHex(const string &s, u64 &x) {
+    if (s.length() != 16) return false;
+    x = 0;
+    for (int i = 0; i < 16; ++i) {
+        char c = s[i];
+        x <<= 4;
+        if (c >= '0' && c <= '9') x |= c - '0';
+        else if (c >= 'a' && c <= 'f') x |= c - 'a' + 10;
+        else return false;
+    }
+    return true;
+}
+
+
+// Pepper of this machine, read once from its file or made & written
+// there if the file is missing. False if neither works
+//==============================================================
+static u64 pepper[2];
+static bool isPepperOk = false;
+static once_flag pepperOnce;
+
+static void loadPepper() {
+    const char *envFile = getenv("APS_PEPPER_FILE");
+    string fileName = envFile && *envFile ? envFile : PEPPER_FILE;
+    ifstream rFile(fileName.c_str());
+    string text;
+    if (rFile >> text) {
+        isPepperOk = text.length() == 32 &&
+                     fromHex(text.substr(0, 16), pepper[0]) &&
+                     fromHex(text.substr(16, 16), pepper[1]);
+        return;
+    }
+    random_device rd;
+    pepper[0] = ((u64)rd() << 32) | rd();
+    pepper[1] = ((u64)rd() << 32) | rd();
+    text = toHex(pepper[0]) + toHex(pepper[1]) + '\n';
+    // O_EXCL: of two processes making it at once only one wins, the
+    // other reads what the winner wrote
+    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        rFile.clear();
+        rFile.open(fileName.c_str());
+        isPepperOk = rFile >> text && text.length() == 32 &&
+                     fromHex(text.substr(0, 16), pepper[0]) &&
+                     fromHex(text.substr(16, 16), pepper[1]);
+        return;
+    }
+    isPepperOk = write(fd, text.c_str(), text.length()) ==
+                 (ssize_t)text.length();
+    close(fd);
+}
+
+static bool getPepper(u64 &p0, u64 &p1) {
+    call_once(pepperOnce, loadPepper);
+    p0 = pepper[0];
+    p1 = pepper[1];
+    return isPepperOk;
+}
+
+
+// Hash secret with key (k0, k1), repeated rounds times
+//==============================================================
+static string hashWithKey(const string &secret, u64 k0, u64 k1,
+                          unsigned int rounds) {
+    u64 h = sipHash(k0, k1, secret);
+    for (unsigned int i = 1; i < rounds; ++i)
+        h = sipHash(k0, k1 ^ h, secret);
+    return toHex(h);
+}
+
+
+string hashSecret(const string &secret, unsigned int rounds) {
+    random_device rd;
+    u64 k0 = ((u64)rd() << 32) | rd();
+    u64 k1 = ((u64)rd() << 32) | rd();
+    string salt = toHex(k0) + toHex(k1);
+    u64 p0, p1;
+    if (!getPepper(p0, p1))
+        return salt + '$' + hashWithKey(secret, k0, k1, rounds);
+    return PEPPER_MARK + salt + '$' +
+           hashWithKey(secret, k0 ^ p0, k1 ^ p1, rounds);
+}
+
+
+bool verifySecret(const string &secret, const string &stored,
+                  unsigned int rounds) {
+    string salted = stored;
+    bool isPeppered = stored.compare(0, PEPPER_MARK.length(),
+                                     PEPPER_MARK) == 0;
+    if (isPeppered) salted = stored.substr(PEPPER_MARK.length());
+    // Legacy records store the secret as plain text
+    if (salted.length() != 16 + 16 + 1 + 16 || salted[32] != '$')
+        return equalsConstTime(secret, stored);
+    u64 k0, k1, p0 = 0, p1 = 0;
+    if (!fromHex(salted.substr(0, 16), k0) ||
+        !fromHex(salted.substr(16, 16), k1))
+        return false;
+    if (isPeppered && !getPepper(p0, p1)) return false;
+    return equalsConstTime(hashWithKey(secret, k0 ^ p0, k1 ^ p1, rounds),
+                           salted.substr(33));
+}
+
+
+bool needsRehash(const string &stored) {
+    u64 p0, p1;
+    return stored.compare(0, PEPPER_MARK.length(), PEPPER_MARK) != 0 &&
+           getPepper(p0, p1);
+}
+
+
+bool equalsConstTime(const string &s1, const string &s2) {
+    // Always walk the whole of s2 so timing only depends on its length
+    unsigned char diff = s1.length() != s2.length();
+    string::size_type n = s1.length();
+    for (string::size_type i = 0; i < s2.length(); ++i)
+        diff |= (unsigned char)((i < n ? s1[i] : 0) ^ s2[i]);
+    return diff == 0;
+}
@@ -0,0 +1,31 @@
+#ifndef SECRET_H
+#define SECRET_H
+#include <string>
+
+// Rounds of hashing for each kind of secret. PINs are checked on
+// every unpark so they use a single keyed hash, the admin password
+// is checked rarely so it is stretched.
+const unsigned int PIN_HASH_ROUNDS = 1;
+const unsigned int ADMIN_HASH_ROUNDS = 20000;
+
+// A 6 digit PIN has only a million values, so a salted hash alone is
+// cracked offline in a moment by whoever copies the data files. Every
+// new hash is also keyed by a pepper kept in PEPPER_FILE (or the file
+// named by APS_PEPPER_FILE), created on first use & readable only by
+// its owner. It only helps while the pepper stays off the machine or
+// backup the data leaks from, keep it out of copies of the data.
+const std::string PEPPER_FILE = "pepper.key";
+const std::string PEPPER_MARK = "p$";
+
+// Hash secret with a new random salt, returns "p$salt$hash" in hex
+// ("salt$hash" without the pepper if PEPPER_FILE can't be used)
+std::string hashSecret(const std::string &, unsigned int);
+// Check secret against a stored hash (or legacy plain text)
+bool verifySecret(const std::string &, const std::string &, unsigned int);
+// Stored as plain text or without the pepper, worth hashing again
+// once the secret is known to be right
+bool needsRehash(const std::string &);
+// Compare two strings without leaking where they differ
+bool equalsConstTime(const std::string &, const std::string &);
+
+#endif
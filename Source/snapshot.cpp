@@ -0,0 +1,16 @@
+#include "snapshot.h"
+using namespace std;
+
+void writeBinStr(ostream &out, const string &s) {
+    writeBin<uint32_t>(out, s.length());
+    out.write(s.data(), s.length());
+}
+
+
+bool readBinStr(istream &in, string &s) {
+    uint32_t len;
+    // Refuse lengths no field of ours could have, e.g. a corrupt file
+    if (!readBin(in, len) || len > MAX_BIN_STR) return false;
+    s.resize(len);
+    return len == 0 || (bool)in.read(&s[0], len);
+}
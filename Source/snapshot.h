@@ -0,0 +1,30 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Binary snapshot of the occupancy state of every site
+const char SNAPSHOT_MAGIC[8] = { 'A', 'P', 'S', 'S', 'N', 'A', 'P', '1' };
+// Version 2 keeps the sales in sen instead of a double, version 3
+// stamps each site with its files & ends with the finished stays
+const uint32_t SNAPSHOT_VERSION = 3;
+
+// Fixed size values are stored in host byte order
+template <typename T>
+void writeBin(std::ostream &out, T value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+template <typename T>
+bool readBin(std::istream &in, T &value) {
+    return (bool)in.read(reinterpret_cast<char *>(&value), sizeof(value));
+}
+
+// Strings are stored as a 32-bit length followed by the bytes, longer
+// than MAX_BIN_STR is taken for a corrupt length
+const uint32_t MAX_BIN_STR = 1 << 16;
+void writeBinStr(std::ostream &, const std::string &);
+bool readBinStr(std::istream &, std::string &);
+
+#endif
@@ -0,0 +1,781 @@
+#include <algorithm>     // equal
+#include <cerrno>        // errno
+#include <condition_variable> // condition_variable
+#include <cstdio>        // remove
+#include <fcntl.h>       // open
+#include <fstream>       // ifstream, ofstream
+#include <map>           // map
+#include <mutex>         // mutex, unique_lock
+#include <set>           // set
+#include <sstream>       // istringstream, ostringstream
+#include <sys/file.h>    // flock
+#include <thread>        // thread
+#include <unistd.h>      // close, truncate
+#include "aps.h"
+#include "snapshot.h"
+#include "storage.h"
+using namespace std;
+
+const char JOURNAL_MAGIC[8] = { 'A', 'P', 'S', 'J', 'N', 'L', '1', '\0' };
+const char JOURNAL_PUT = 'P';
+const char JOURNAL_DEL = 'D';
+const u32 MIN_JOURNAL_COMPACT = 64;
+const char KV_SEGMENT_MAGIC[8] = { 'A', 'P', 'S', 'S', 'E', 'G', '1', '\0' };
+const string KV_MANIFEST_HEADER = "APSKV1";
+const string KV_LOG_EXT = ".wal";
+const string KV_MANIFEST_EXT = ".kv";
+const string KV_SEGMENT_EXT = ".seg";
+const int KV_LOAD_ATTEMPTS = 8;
+
+
+//==============================================================
+//          TextStorage: the original apscar.dat format         //
+//==============================================================
+
+
+TextStorage::TextStorage(string fileName) {
+    this->file_name = fileName;
+}
+
+
+bool TextStorage::load(vector<Transport> &trans) {
+    ifstream apsRF(this->file_name.c_str());
+    this->records.clear();
+    trans.clear();
+    // No file yet? Then nothing is parked, append() makes it
+    if (!apsRF.good()) return stampFile(this->file_name).size < 0;
+    // Store all file data in a single pass, a line that is not a whole
+    // record means the file is damaged: nothing after it may be lost
+    Transport tempTrans;
+    string line, extra;
+    while (getline(apsRF, line)) {
+        istringstream ss(line);
+        if (!(ss >> tempTrans.lot_no)) continue;
+        if (!(ss >> tempTrans.plate_no
+                 >> tempTrans.date_time_in
+                 >> tempTrans.pin_no) || ss >> extra) {
+            this->records.clear();
+            return false;
+        }
+        this->records.push_back(tempTrans);
+    }
+    if (apsRF.bad()) {
+        this->records.clear();
+        return false;
+    }
+    apsRF.close();
+    trans = this->records;
+    return true;
+}
+
+
+bool TextStorage::append(const Transport &newTrans) {
+    ofstream apsWF(this->file_name.c_str(), ios::app);
+    apsWF << newTrans.lot_no << ' '
+          << newTrans.plate_no << ' '
+          << newTrans.date_time_in << ' '
+          << newTrans.pin_no << '\n';
+    apsWF.close();
+    if (!apsWF.good()) return false;
+    this->records.push_back(newTrans);
+    return true;
+}
+
+
+bool TextStorage::remove(const string &plateNo) {
+    vector<Transport> remaining;
+    for (int i = 0; i < (int)this->records.size(); ++i)
+        if (this->records[i].plate_no.compare(plateNo) != 0)
+            remaining.push_back(this->records[i]);
+    return TextStorage::rewrite(remaining);
+}
+
+
+// Write into a temp file that replaces the file once complete, so
+// readers always see either the old or the new version
+bool TextStorage::rewrite(const vector<Transport> &trans) {
+    string tempName = makeTempName(this->file_name);
+    ofstream apsWF(tempName.c_str());
+    for (int i = 0; i < (int)trans.size(); ++i)
+        apsWF << trans[i].lot_no << ' '
+              << trans[i].plate_no << ' '
+              << trans[i].date_time_in << ' '
+              << trans[i].pin_no << '\n';
+    apsWF.close();
+    if (!apsWF.good() || !replaceFile(tempName, this->file_name)) {
+        std::remove(tempName.c_str());
+        return false;
+    }
+    this->records = trans;
+    return true;
+}
+
+
+void TextStorage::preload(const vector<Transport> &trans) {
+    this->records = trans;
+}
+
+
+string TextStorage::getFileName() {
+    return this->file_name;
+}
+
+
+//==============================================================
+//     Journal files: the entries of JournalStorage & KvStorage //
+//==============================================================
+
+
+// One change of a journal: a park, or an unpark (plate_no only)
+struct JournalEntry {
+    char op;
+    Transport trans;
+};
+
+
+static void writeJournalEntry(ostream &out, char op, const Transport &trans) {
+    out.put(op);
+    if (op == JOURNAL_DEL) {
+        writeBinStr(out, trans.plate_no);
+        return;
+    }
+    writeBinStr(out, trans.lot_no);
+    writeBinStr(out, trans.plate_no);
+    writeBin<int64_t>(out, trans.date_time_in);
+    writeBinStr(out, trans.pin_no);
+}
+
+
+// Entries of a journal read at once, which starts with the magic.
+// Running out of bytes inside an entry is a last entry torn by a crash:
+// the entries stop before it, & goodEnd is where they end. False if the
+// journal is corrupt (another magic, an unknown entry, a field too long)
+//==============================================================
+static bool parseJournal(const string &data, const char *magic,
+                         vector<JournalEntry> &entries, int64_t &goodEnd) {
+    entries.clear();
+    istringstream in(data);
+    char head[sizeof(JOURNAL_MAGIC)];
+    if (!in.read(head, sizeof(head)) ||
+        !equal(head, head + sizeof(head), magic))
+        return false;
+    goodEnd = sizeof(head);
+
+    JournalEntry entry;
+    int64_t dateTime = 0;
+    while (in.get(entry.op)) {
+        bool isRead;
+        entry.trans.lot_no.clear();
+        entry.trans.pin_no.clear();
+        if (entry.op == JOURNAL_PUT) {
+            isRead = readBinStr(in, entry.trans.lot_no) &&
+                     readBinStr(in, entry.trans.plate_no) &&
+                     readBin(in, dateTime) &&
+                     readBinStr(in, entry.trans.pin_no);
+        } else if (entry.op == JOURNAL_DEL) {
+            dateTime = 0;
+            isRead = readBinStr(in, entry.trans.plate_no);
+        } else {
+            return false;
+        }
+        // Not torn unless it ran into the end of the journal
+        if (!isRead) return in.eof();
+        entry.trans.date_time_in = dateTime;
+        entries.push_back(entry);
+        goodEnd = in.tellg();
+    }
+    return true;
+}
+
+
+// Whole file at once, false if it can't be opened or read
+static bool readWholeFile(string fileName, string &data) {
+    ifstream rFile(fileName.c_str(), ios::binary | ios::ate);
+    if (!rFile.good()) return false;
+    data.assign((size_t)rFile.tellg(), '\0');
+    rFile.seekg(0, rFile.beg);
+    return data.empty() || (bool)rFile.read(&data[0], data.size());
+}
+
+
+// Write into a temp file that replaces the file once complete
+static bool replaceWithData(string fileName, const string &data) {
+    string tempName = makeTempName(fileName);
+    ofstream tempWF(tempName.c_str(), ios::binary);
+    tempWF.write(data.data(), data.size());
+    tempWF.close();
+    if (!tempWF.good() || !replaceFile(tempName, fileName)) {
+        std::remove(tempName.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// Append an entry, cutting off a torn last entry first (where the load
+// found it) so it can't swallow this one. Only while the files are
+// locked, & only if nobody appended since the load
+//==============================================================
+static bool appendJournal(string fileName, const string &entry,
+                          int64_t &goodEnd, int64_t &fileEnd) {
+    int64_t size = stampFile(fileName).size;
+    if (goodEnd >= 0 && goodEnd < fileEnd && size == fileEnd) {
+        if (truncate(fileName.c_str(), goodEnd) != 0) return false;
+        fileEnd = goodEnd;
+    }
+    ofstream jnlWF(fileName.c_str(), ios::binary | ios::app);
+    // The first entry makes the journal
+    if (size < 0) jnlWF.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    jnlWF.write(entry.data(), entry.size());
+    jnlWF.close();
+    if (!jnlWF.good()) {
+        goodEnd = fileEnd = -1;
+        return false;
+    }
+    if (goodEnd == fileEnd && goodEnd >= 0)
+        goodEnd = fileEnd = fileEnd + entry.size();
+    return true;
+}
+
+
+//==============================================================
+//        JournalStorage: binary log of parks & unparks         //
+//==============================================================
+
+
+JournalStorage::JournalStorage(string fileName) {
+    this->file_name = fileName;
+    this->good_end = this->file_end = -1;
+    this->total_entries = this->live_entries = -1;
+}
+
+
+bool JournalStorage::load(vector<Transport> &trans) {
+    trans.clear();
+    this->good_end = this->file_end = -1;
+    this->total_entries = this->live_entries = -1;
+    string data;
+    // No journal yet? Then nothing is parked, the first append makes it
+    if (!readWholeFile(this->file_name, data))
+        return stampFile(this->file_name).size < 0;
+    vector<JournalEntry> entries;
+    int64_t goodEnd;
+    if (!parseJournal(data, JOURNAL_MAGIC, entries, goodEnd)) return false;
+
+    // Replay, keeping the order vehicles were parked in
+    map<string, int> index;
+    for (int i = 0; i < (int)entries.size(); ++i) {
+        const Transport &entry = entries[i].trans;
+        // Parked again without an unpark? The latest one wins
+        map<string, int>::iterator it = index.find(entry.plate_no);
+        if (it != index.end()) {
+            trans[it->second].plate_no = "";
+            index.erase(it);
+        }
+        if (entries[i].op == JOURNAL_PUT) {
+            index[entry.plate_no] = trans.size();
+            trans.push_back(entry);
+        }
+    }
+
+    vector<Transport> live;
+    for (int i = 0; i < (int)trans.size(); ++i)
+        if (!trans[i].plate_no.empty())
+            live.push_back(trans[i]);
+    trans.swap(live);
+    this->good_end = goodEnd;
+    this->file_end = data.size();
+    this->total_entries = entries.size();
+    this->live_entries = trans.size();
+    return true;
+}
+
+
+bool JournalStorage::appendEntry(const string &entry) {
+    if (!appendJournal(this->file_name, entry,
+                       this->good_end, this->file_end)) {
+        this->total_entries = this->live_entries = -1;
+        return false;
+    }
+    if (this->total_entries >= 0) ++this->total_entries;
+    return true;
+}
+
+
+bool JournalStorage::append(const Transport &newTrans) {
+    ostringstream entry;
+    writeJournalEntry(entry, JOURNAL_PUT, newTrans);
+    if (!JournalStorage::appendEntry(entry.str())) return false;
+    if (this->live_entries >= 0) ++this->live_entries;
+    return true;
+}
+
+
+// Mostly tombstones after the unpark? Start a fresh journal of what is
+// still parked. The lock is held, so nothing is appended meanwhile; the
+// unpark is kept even if this fails
+//==============================================================
+bool JournalStorage::remove(const string &plateNo) {
+    ostringstream entry;
+    Transport oldTrans;
+    oldTrans.plate_no = plateNo;
+    writeJournalEntry(entry, JOURNAL_DEL, oldTrans);
+    if (!JournalStorage::appendEntry(entry.str())) return false;
+    if (this->live_entries > 0) --this->live_entries;
+    if (this->total_entries > MIN_JOURNAL_COMPACT &&
+        this->total_entries > 2 * this->live_entries) {
+        vector<Transport> trans;
+        if (JournalStorage::load(trans)) JournalStorage::rewrite(trans);
+    }
+    return true;
+}
+
+
+bool JournalStorage::rewrite(const vector<Transport> &trans) {
+    ostringstream jnl;
+    jnl.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    for (int i = 0; i < (int)trans.size(); ++i)
+        writeJournalEntry(jnl, JOURNAL_PUT, trans[i]);
+    this->good_end = this->file_end = -1;
+    this->total_entries = this->live_entries = -1;
+    if (!replaceWithData(this->file_name, jnl.str())) return false;
+    this->total_entries = this->live_entries = trans.size();
+    return true;
+}
+
+
+// Nothing to keep, every change is appended
+void JournalStorage::preload(const vector<Transport> &) {
+    this->good_end = this->file_end = -1;
+    this->total_entries = this->live_entries = -1;
+}
+
+
+string JournalStorage::getFileName() {
+    return this->file_name;
+}
+
+
+//==============================================================
+//     KvStorage: memtable, sorted segments & their compaction  //
+//==============================================================
+
+
+// One thread per process merges the segments of the stores that
+// asked, outliving the storage objects of the gates. A store asked for
+// twice is merged once. The program finishes the merges it queued as
+// it exits, after its gates have answered
+class KvCompactor
+{
+    public:
+        KvCompactor() : busy(false), stopping(false) {}
+        void request(std::string);
+        void wait();
+        ~KvCompactor();
+    private:
+        void run();
+        std::mutex lock;
+        std::condition_variable has_work;
+        std::condition_variable all_done;
+        std::set<std::string> pending;
+        std::thread worker;
+        bool busy;
+        bool stopping;
+};
+static KvCompactor kvCompactor;
+
+
+void KvCompactor::request(string baseName) {
+    unique_lock<mutex> guard(this->lock);
+    if (this->stopping) return;
+    this->pending.insert(baseName);
+    if (!this->worker.joinable())
+        this->worker = thread(&KvCompactor::run, this);
+    this->has_work.notify_one();
+}
+
+
+void KvCompactor::wait() {
+    unique_lock<mutex> guard(this->lock);
+    while (this->busy || !this->pending.empty())
+        this->all_done.wait(guard);
+}
+
+
+void KvCompactor::run() {
+    unique_lock<mutex> guard(this->lock);
+    while (true) {
+        while (!this->stopping && this->pending.empty())
+            this->has_work.wait(guard);
+        if (this->pending.empty()) break;
+        string baseName = *this->pending.begin();
+        this->pending.erase(this->pending.begin());
+        this->busy = true;
+        guard.unlock();
+        KvStorage::compact(baseName);
+        guard.lock();
+        this->busy = false;
+        this->all_done.notify_all();
+    }
+}
+
+
+KvCompactor::~KvCompactor() {
+    {
+        lock_guard<mutex> guard(this->lock);
+        this->stopping = true;
+        this->has_work.notify_one();
+    }
+    if (this->worker.joinable()) this->worker.join();
+}
+
+
+void waitForCompactions() {
+    kvCompactor.wait();
+}
+
+
+KvStorage::KvStorage(string baseName) {
+    this->base_name = baseName;
+    this->log_entries = -1;
+    this->good_end = this->file_end = -1;
+}
+
+
+// The log is read before the manifest, & a flush lists its segment
+// before it empties the log, so no change falls in between. Anything
+// else written meanwhile (e.g. a compaction removing segments) shows in
+// the stamps, & the store is read again
+//==============================================================
+bool KvStorage::load(vector<Transport> &trans) {
+    trans.clear();
+    string logName = this->getFileName();
+    string manifestName = this->base_name + KV_MANIFEST_EXT;
+    KvTable table;
+    bool isRead = false;
+    for (int i = 0; i < KV_LOAD_ATTEMPTS && !isRead; ++i) {
+        FileStamp logStamp = stampFile(logName);
+        FileStamp manifestStamp = stampFile(manifestName);
+        if (!this->readLog(this->memtable, this->log_entries)) return false;
+        vector<string> segments;
+        if (!readManifest(this->base_name, segments)) return false;
+        table.clear();
+        bool isComplete = true;
+        for (int j = 0; j < (int)segments.size() && isComplete; ++j)
+            isComplete = readSegment(this->base_name + segments[j], table);
+        // Still changing after the last attempt? Take it as read
+        isRead = isComplete &&
+                 ((isSameStamp(logStamp, stampFile(logName)) &&
+                   isSameStamp(manifestStamp, stampFile(manifestName))) ||
+                  i == KV_LOAD_ATTEMPTS - 1);
+    }
+    if (!isRead) return false;
+
+    // Newer changes win: the segments oldest first, then the memtable
+    KvTable::const_iterator it;
+    for (it = this->memtable.begin(); it != this->memtable.end(); ++it)
+        table[it->first] = it->second;
+    for (it = table.begin(); it != table.end(); ++it)
+        if (it->second.is_parked) trans.push_back(it->second.trans);
+    return true;
+}
+
+
+bool KvStorage::append(const Transport &newTrans) {
+    KvEntry entry;
+    entry.trans = newTrans;
+    entry.is_parked = true;
+    return KvStorage::logEntry(entry);
+}
+
+
+bool KvStorage::remove(const string &plateNo) {
+    KvEntry entry;
+    entry.trans.plate_no = plateNo;
+    entry.trans.date_time_in = 0;
+    entry.is_parked = false;
+    return KvStorage::logEntry(entry);
+}
+
+
+// One segment of these vehicles replaces the others & the log
+//==============================================================
+bool KvStorage::rewrite(const vector<Transport> &trans) {
+    KvTable table;
+    for (int i = 0; i < (int)trans.size(); ++i) {
+        KvEntry &entry = table[trans[i].plate_no];
+        entry.trans = trans[i];
+        entry.is_parked = true;
+    }
+    FileLock manifestLock(this->base_name + KV_MANIFEST_EXT);
+    vector<string> oldSegments, segments;
+    // Replaced either way, even if it can't be read
+    readManifest(this->base_name, oldSegments);
+    string segment = writeSegment(this->base_name, table);
+    if (segment.empty()) return false;
+    segments.push_back(segment);
+    if (!writeManifest(this->base_name, segments)) {
+        std::remove((this->base_name + segment).c_str());
+        return false;
+    }
+    this->memtable.clear();
+    this->log_entries = 0;
+    this->good_end = this->file_end = -1;
+    for (int i = 0; i < (int)oldSegments.size(); ++i)
+        std::remove((this->base_name + oldSegments[i]).c_str());
+    return replaceWithData(this->getFileName(),
+                           string(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)));
+}
+
+
+// The log is only read again if something is appended
+void KvStorage::preload(const vector<Transport> &) {
+    this->memtable.clear();
+    this->log_entries = -1;
+    this->good_end = this->file_end = -1;
+}
+
+
+string KvStorage::getFileName() {
+    return this->base_name + KV_LOG_EXT;
+}
+
+
+// Replay the log into the memtable, none if there is no log yet
+//==============================================================
+bool KvStorage::readLog(KvTable &table, int &totalEntries) {
+    string data, logName = this->getFileName();
+    table.clear();
+    totalEntries = -1;
+    this->good_end = this->file_end = -1;
+    // No log yet? The first append makes it
+    if (!readWholeFile(logName, data)) {
+        if (stampFile(logName).size >= 0) return false;
+        totalEntries = 0;
+        return true;
+    }
+    vector<JournalEntry> entries;
+    int64_t goodEnd;
+    if (!parseJournal(data, JOURNAL_MAGIC, entries, goodEnd)) return false;
+    for (int i = 0; i < (int)entries.size(); ++i) {
+        KvEntry &entry = table[entries[i].trans.plate_no];
+        entry.trans = entries[i].trans;
+        entry.is_parked = entries[i].op == JOURNAL_PUT;
+    }
+    totalEntries = entries.size();
+    this->good_end = goodEnd;
+    this->file_end = data.size();
+    return true;
+}
+
+
+// Append a change to the log & the memtable, which is flushed once
+// the log is full. The change is kept even if the flush fails
+//==============================================================
+bool KvStorage::logEntry(const KvEntry &entry) {
+    if (this->log_entries < 0 &&
+        !this->readLog(this->memtable, this->log_entries))
+        return false;
+    ostringstream data;
+    writeJournalEntry(data, entry.is_parked ? JOURNAL_PUT : JOURNAL_DEL,
+                      entry.trans);
+    if (!appendJournal(this->getFileName(), data.str(),
+                       this->good_end, this->file_end))
+        return false;
+    this->memtable[entry.trans.plate_no] = entry;
+    if (++this->log_entries >= KV_MEMTABLE_LIMIT)
+        this->flushMemtable();
+    return true;
+}
+
+
+// Write the memtable out as the newest segment, then empty the log.
+// The manifest is locked as a compaction may be changing it
+//==============================================================
+bool KvStorage::flushMemtable() {
+    FileLock manifestLock(this->base_name + KV_MANIFEST_EXT);
+    vector<string> segments;
+    if (!readManifest(this->base_name, segments)) return false;
+    string segment = writeSegment(this->base_name, this->memtable);
+    if (segment.empty()) return false;
+    segments.push_back(segment);
+    if (!writeManifest(this->base_name, segments)) {
+        std::remove((this->base_name + segment).c_str());
+        return false;
+    }
+    // Entries left in the log are in the segment too, no harm if this
+    // fails & they are read again
+    if (!replaceWithData(this->getFileName(),
+                         string(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC))))
+        return false;
+    this->memtable.clear();
+    this->log_entries = 0;
+    this->good_end = this->file_end = -1;
+    if ((int)segments.size() >= KV_MAX_SEGMENTS)
+        kvCompactor.request(this->base_name);
+    return true;
+}
+
+
+// Manifest: a header line, then the name of each segment (after the
+// base name, e.g. ".seg.Ab3xZ9") oldest first. None is no segment
+//==============================================================
+bool KvStorage::readManifest(string baseName, vector<string> &segments) {
+    segments.clear();
+    ifstream kvRF((baseName + KV_MANIFEST_EXT).c_str());
+    if (!kvRF.good()) return true;
+    string line;
+    if (!getline(kvRF, line) || line.compare(KV_MANIFEST_HEADER) != 0)
+        return false;
+    while (getline(kvRF, line))
+        if (!line.empty()) segments.push_back(line);
+    return !kvRF.bad();
+}
+
+
+bool KvStorage::writeManifest(string baseName,
+                              const vector<string> &segments) {
+    string data = KV_MANIFEST_HEADER + '\n';
+    for (int i = 0; i < (int)segments.size(); ++i)
+        data += segments[i] + '\n';
+    return replaceWithData(baseName + KV_MANIFEST_EXT, data);
+}
+
+
+// Entries of a segment over those of older ones. Segments are never
+// torn, they are listed only once complete
+//==============================================================
+bool KvStorage::readSegment(string segName, KvTable &table) {
+    string data;
+    vector<JournalEntry> entries;
+    int64_t goodEnd;
+    if (!readWholeFile(segName, data) ||
+        !parseJournal(data, KV_SEGMENT_MAGIC, entries, goodEnd) ||
+        goodEnd != (int64_t)data.size())
+        return false;
+    for (int i = 0; i < (int)entries.size(); ++i) {
+        KvEntry &entry = table[entries[i].trans.plate_no];
+        entry.trans = entries[i].trans;
+        entry.is_parked = entries[i].op == JOURNAL_PUT;
+    }
+    return true;
+}
+
+
+// New segment file of the entries sorted by plate, named uniquely
+// across processes. Its name after the base name, empty if not written
+//==============================================================
+string KvStorage::writeSegment(string baseName, const KvTable &table) {
+    string segName = makeTempName(baseName + KV_SEGMENT_EXT);
+    if (segName.empty()) return "";
+    ostringstream seg;
+    seg.write(KV_SEGMENT_MAGIC, sizeof(KV_SEGMENT_MAGIC));
+    KvTable::const_iterator it;
+    for (it = table.begin(); it != table.end(); ++it)
+        writeJournalEntry(seg, it->second.is_parked ? JOURNAL_PUT
+                                                    : JOURNAL_DEL,
+                          it->second.trans);
+    ofstream segWF(segName.c_str(), ios::binary);
+    string data = seg.str();
+    segWF.write(data.data(), data.size());
+    segWF.close();
+    if (!segWF.good()) {
+        std::remove(segName.c_str());
+        return "";
+    }
+    return segName.substr(baseName.length());
+}
+
+
+// Merge the segments into one off the gate's path: the manifest is
+// only locked to read it & to swap in the merged segment, which is
+// given up if another compaction got there first. Tombstones go, as
+// no older segment is left for them to hide anything in
+//==============================================================
+void KvStorage::compact(string baseName) {
+    vector<string> merged, segments;
+    {
+        FileLock manifestLock(baseName + KV_MANIFEST_EXT);
+        if (!readManifest(baseName, merged) ||
+            (int)merged.size() < KV_MAX_SEGMENTS)
+            return;
+    }
+    KvTable table;
+    for (int i = 0; i < (int)merged.size(); ++i)
+        if (!readSegment(baseName + merged[i], table)) return;
+    for (KvTable::iterator it = table.begin(); it != table.end(); )
+        if (it->second.is_parked) ++it;
+        else table.erase(it++);
+    string segment = writeSegment(baseName, table);
+    if (segment.empty()) return;
+
+    FileLock manifestLock(baseName + KV_MANIFEST_EXT);
+    // Segments flushed meanwhile come after the merged ones
+    if (!readManifest(baseName, segments) ||
+        segments.size() < merged.size() ||
+        !equal(merged.begin(), merged.end(), segments.begin())) {
+        std::remove((baseName + segment).c_str());
+        return;
+    }
+    segments.erase(segments.begin(), segments.begin() + merged.size());
+    segments.insert(segments.begin(), segment);
+    if (!writeManifest(baseName, segments)) {
+        std::remove((baseName + segment).c_str());
+        return;
+    }
+    for (int i = 0; i < (int)merged.size(); ++i)
+        std::remove((baseName + merged[i]).c_str());
+}
+
+
+//==============================================================
+//      FileLock: one process at a time reads & writes a file   //
+//==============================================================
+
+
+//  Constructor: wait for the lock, not locked if it can't be opened
+//==============================================================
+FileLock::FileLock(string fileName) {
+    string lockName = fileName + ".lock";
+    this->fd = open(lockName.c_str(), O_RDWR | O_CREAT, 0644);
+    if (this->fd < 0) return;
+    // Retry when a signal cut the wait short
+    int result;
+    do {
+        result = flock(this->fd, LOCK_EX);
+    } while (result != 0 && errno == EINTR);
+    if (result != 0) {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+
+
+bool FileLock::isLocked() {
+    return this->fd >= 0;
+}
+
+
+//  Destructor: closing the file lets the lock go
+//==============================================================
+FileLock::~FileLock() {
+    if (this->fd >= 0) close(this->fd);
+}
+
+
+//==============================================================
+
+
+unique_ptr<Storage> makeStorage(string storageType, string fileName) {
+    if (storageType.compare(STORAGE_TEXT) == 0)
+        return unique_ptr<Storage>(new TextStorage(fileName));
+    // apscar.dat is journaled in apscar.jnl, or kept in apscar.wal ..
+    string baseName = fileName;
+    string::size_type dot = baseName.rfind(".dat");
+    if (dot != string::npos) baseName.erase(dot);
+    if (storageType.compare(STORAGE_JOURNAL) == 0)
+        return unique_ptr<Storage>(new JournalStorage(baseName + ".jnl"));
+    if (storageType.compare(STORAGE_KV) == 0)
+        return unique_ptr<Storage>(new KvStorage(baseName));
+    return unique_ptr<Storage>();
+}
@@ -0,0 +1,160 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One parked vehicle as kept by a storage backend
+struct Transport {
+    std::string lot_no;
+    std::string plate_no;
+    time_t date_time_in;
+    std::string pin_no;
+};
+
+
+// Where the parked vehicles of one site & vehicle type are kept.
+// AutoParkingSystem only talks to this interface, so backends can be
+// swapped without touching the parking logic.
+class Storage
+{
+    public:
+        virtual ~Storage() {}
+        // Load every parked vehicle, none if there is no store yet.
+        // False if the store can't be read or is corrupt, which must
+        // not be written over. Never writes, readers may call it
+        // without the lock
+        virtual bool load(std::vector<Transport> &) = 0;
+        // Add a newly parked vehicle, creating the store if needed.
+        // These 3 change the store, only while holding its FileLock
+        virtual bool append(const Transport &) = 0;
+        // Remove the vehicle with this plate_no
+        virtual bool remove(const std::string &) = 0;
+        // Replace everything with these vehicles
+        virtual bool rewrite(const std::vector<Transport> &) = 0;
+        // Take vehicles known to be what the store holds (e.g. from a
+        // snapshot) in place of load()
+        virtual void preload(const std::vector<Transport> &) = 0;
+        // File the vehicles are kept in
+        virtual std::string getFileName() = 0;
+};
+
+
+// Legacy text file: one "lot plate time pin" line per vehicle
+class TextStorage : public Storage
+{
+    public:
+        TextStorage(std::string);
+        bool load(std::vector<Transport> &);
+        bool append(const Transport &);
+        bool remove(const std::string &);
+        bool rewrite(const std::vector<Transport> &);
+        void preload(const std::vector<Transport> &);
+        std::string getFileName();
+    private:
+        std::string file_name;
+        std::vector<Transport> records;
+};
+
+
+// Binary append-only journal: parking appends a record & unparking
+// appends a tombstone, so both are O(1). The journal is compacted to
+// the live records when an unpark leaves it mostly dead. A last entry
+// torn by a crash is cut off by the next append, any other damage
+// fails load().
+class JournalStorage : public Storage
+{
+    public:
+        JournalStorage(std::string);
+        bool load(std::vector<Transport> &);
+        bool append(const Transport &);
+        bool remove(const std::string &);
+        bool rewrite(const std::vector<Transport> &);
+        void preload(const std::vector<Transport> &);
+        std::string getFileName();
+    private:
+        bool appendEntry(const std::string &);
+        std::string file_name;
+        int64_t good_end;     // Where the last whole entry ends, -1 if
+        int64_t file_end;     // not read; & the size as read
+        int64_t total_entries;    // Entries & live vehicles in the
+        int64_t live_entries;     // journal, -1 if not read
+};
+
+
+// Log-structured key-value engine keyed by plate. Changes are appended
+// to a log (the journal format) & kept in a sorted memtable, which is
+// written out as an immutable segment sorted by plate once the log
+// holds KV_MEMTABLE_LIMIT entries. A manifest lists the segments oldest
+// first, & once there are KV_MAX_SEGMENTS the compactor thread of the
+// process merges them into one, the gate that flushed does not wait.
+// apscar.dat is kept in apscar.wal, apscar.kv & apscar.seg.* files.
+const int KV_MEMTABLE_LIMIT = 64;
+const int KV_MAX_SEGMENTS = 4;
+class KvStorage : public Storage
+{
+    public:
+        KvStorage(std::string);
+        bool load(std::vector<Transport> &);
+        bool append(const Transport &);
+        bool remove(const std::string &);
+        bool rewrite(const std::vector<Transport> &);
+        void preload(const std::vector<Transport> &);
+        std::string getFileName();
+    private:
+        friend class KvCompactor;
+        // Latest change of each plate, a tombstone if not is_parked
+        struct KvEntry {
+            Transport trans;
+            bool is_parked;
+        };
+        typedef std::map<std::string, KvEntry> KvTable;
+        bool readLog(KvTable &, int &);
+        bool logEntry(const KvEntry &);
+        bool flushMemtable();
+        static bool readManifest(std::string, std::vector<std::string> &);
+        static bool writeManifest(std::string,
+                                  const std::vector<std::string> &);
+        static bool readSegment(std::string, KvTable &);
+        static std::string writeSegment(std::string, const KvTable &);
+        static void compact(std::string);
+        std::string base_name;
+        KvTable memtable;
+        int log_entries;      // Entries in the log, -1 if not read
+        int64_t good_end;     // As in JournalStorage, for the log
+        int64_t file_end;
+};
+// Wait for the compactions this process has queued, e.g. before its
+// files are removed
+void waitForCompactions();
+
+
+// Advisory lock (flock) of a data file, held until it is destroyed. A
+// process taking the lock of the same file waits for it, the lock is
+// kept in a file next to it (apscar.dat.lock)
+class FileLock
+{
+    public:
+        explicit FileLock(std::string);
+        bool isLocked();
+        ~FileLock();
+    private:
+        FileLock(const FileLock &);
+        FileLock &operator=(const FileLock &);
+        int fd;
+};
+
+
+// Storage types that can be passed to makeStorage()
+const std::string STORAGE_TEXT = "TEXT";
+const std::string STORAGE_JOURNAL = "JOURNAL";
+const std::string STORAGE_KV = "KV";
+
+// Backend of the given type for a data file such as apscar.dat,
+// null if the type is unknown
+std::unique_ptr<Storage> makeStorage(std::string, std::string);
+
+#endif